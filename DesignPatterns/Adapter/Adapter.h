@@ -1,16 +1,66 @@
 #pragma once
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include "../Delegate/Delegate.h"
+#include "HostResolverCache.h"
+#include "UDPSocketPool.h"
+
 namespace adapter_pattern
 {
 	// the interface of our engine socket
 	class IUDPSendSocket
 	{
 	public:
+		struct Datagram
+		{
+			const char* host;
+			const char* buffer;
+			size_t size;
+		};
+
 		virtual ~IUDPSendSocket() {}
 
 		virtual void open() = 0;
 		virtual void close() = 0;
 		virtual void send(const char* host, const char* buffer, size_t size) = 0;
+
+		// binds the socket to a single destination, sends to it skip the per-packet address lookup.
+		// sockets to other hosts keep working
+		virtual bool connect(const char* host) { (void)host; return true; }
+
+		// sends count datagrams, returns how many of them went out.
+		// sockets able to hand a whole batch to the platform at once override it
+		virtual size_t sendBatch(const Datagram* datagrams, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				send(datagrams[i].host, datagrams[i].buffer, datagrams[i].size);
+			return count;
+		}
+	};
+
+	// the receiving side of our engine socket
+	class IUDPRecvSocket
+	{
+	public:
+		// borrowed view of a received datagram, only valid for the duration of the handler call
+		struct PacketView
+		{
+			const char* data;
+			size_t size;
+			uint32_t fromAddress;	// ipv4, host byte order
+			uint16_t fromPort;
+		};
+
+		using Handler = Delegate<void(const PacketView&)>;
+
+		virtual ~IUDPRecvSocket() {}
+
+		virtual bool open(unsigned short port) = 0;
+		virtual void close() = 0;
+
+		// hands every datagram already queued to the handler without blocking, returns how many there were
+		virtual size_t receive(const Handler& handler) = 0;
 	};
 
 	// platform socket lib
@@ -56,24 +106,72 @@ namespace adapter_pattern
 		}
 	};
 
+	// BSDSocket name resolution behind the resolver interface of the cache
+	class BSDSocketResolver : public IHostResolver
+	{
+	public:
+		bool resolve(const char* host, char* buff, size_t size) override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return socket.gethostbyname(host, buff, size);
+		}
+
+	private:
+		std::mutex mutex;
+		BSDSocket socket;
+	};
+
+	// one cache for the whole process, so every adapter benefits from what the others resolved
+	inline HostResolverCache& sharedHostResolverCache()
+	{
+		static BSDSocketResolver resolver;
+		static HostResolverCache cache(&resolver);
+		return cache;
+	}
+
 	// object adapter
 	// will adapt BSDSocket to IUDPSendSocket
 	class AdapterBSD_UDP: public IUDPSendSocket
 	{
 	public:
+		explicit AdapterBSD_UDP(HostResolverCache& _resolver = sharedHostResolverCache()) : resolver(_resolver) {}
+
 		void open() override { socket.open(BSDSocket::Protocol::UDP); }
-		void close() override { socket.shutdown(); }
+		void close() override
+		{
+			socket.shutdown();
+			connectedHost.clear();
+		}
+
+		bool connect(const char* host) override
+		{
+			if (!resolver.resolve(host, connectedIP, sizeof(connectedIP)))
+				return false;
+
+			socket.connect(connectedIP);
+			connectedHost = host;
+			return true;
+		}
 
 		void send(const char* host, const char* buffer, size_t size) override
 		{
-			char hostIP[256];
-			memset(hostIP, 0, 256);
-			socket.gethostbyname(host, hostIP, 256);
+			if (!connectedHost.empty() && connectedHost == host)
+			{
+				socket.send(connectedIP, buffer, size);
+				return;
+			}
+
+			char hostIP[HostResolverCache::MaxAddress];
+			if (!resolver.resolve(host, hostIP, sizeof(hostIP)))
+				return;
 
 			socket.send(hostIP, buffer, size);
 		}
 	private:
 		BSDSocket socket;
+		HostResolverCache& resolver;
+		std::string connectedHost;
+		char connectedIP[HostResolverCache::MaxAddress];
 	};
 
 	// class adapter
@@ -81,30 +179,56 @@ namespace adapter_pattern
 	class AdapterBSD_UDPLightweight: public IUDPSendSocket, private BSDSocket
 	{
 	public:
-		AdapterBSD_UDPLightweight() { BSDSocket::open(Protocol::UDP); }
+		explicit AdapterBSD_UDPLightweight(HostResolverCache& _resolver = sharedHostResolverCache())
+			: resolver(_resolver)
+		{
+			BSDSocket::open(Protocol::UDP);
+		}
 		~AdapterBSD_UDPLightweight() override { BSDSocket::shutdown(); }
 
 		// we rather open/close it in the c'tor/d'tor to give it a leight weight appearence
 		void open() override {}
 		void close() override {}
 
+		bool connect(const char* host) override
+		{
+			if (!resolver.resolve(host, connectedIP, sizeof(connectedIP)))
+				return false;
+
+			BSDSocket::connect(connectedIP);
+			connectedHost = host;
+			return true;
+		}
+
 		void send(const char* host, const char* buffer, size_t size) override
 		{
-			char hostIP[256];
-			memset(hostIP, 0, 256);
-			BSDSocket::gethostbyname(host, hostIP, 256);
+			if (!connectedHost.empty() && connectedHost == host)
+			{
+				BSDSocket::send(connectedIP, buffer, size);
+				return;
+			}
+
+			char hostIP[HostResolverCache::MaxAddress];
+			if (!resolver.resolve(host, hostIP, sizeof(hostIP)))
+				return;
+
 			BSDSocket::send(hostIP, buffer, size);
 		}
+
+	private:
+		HostResolverCache& resolver;
+		std::string connectedHost;
+		char connectedIP[HostResolverCache::MaxAddress];
 	};
 
+	// the convenience api keeps its one-liner appearance, the sockets behind it live in a process wide pool
 	void QuickSend(const char* hostname, const char* buffer, size_t size)
 	{
-		AdapterBSD_UDP socket;
-		socket.send(hostname, buffer, size);
+		UDPSocketPool<AdapterBSD_UDP>::shared().send(hostname, buffer, size);
 	}
 
 	void QuickSend2(const char* hostname, const char* buffer, size_t size)
 	{
-		AdapterBSD_UDPLightweight().send(hostname, buffer, size);
+		UDPSocketPool<AdapterBSD_UDPLightweight>::shared().send(hostname, buffer, size);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,320 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include "Adapter.h"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace adapter_pattern
+{
+	// name resolution through getaddrinfo, ipv4 only like the adapter using it
+	class SystemHostResolver : public IHostResolver
+	{
+	public:
+		bool resolve(const char* host, char* buff, size_t size) override
+		{
+			addrinfo hints;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_INET;
+			hints.ai_socktype = SOCK_DGRAM;
+
+			addrinfo* result = nullptr;
+			if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result)
+				return false;
+
+			bool converted = inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr, buff, static_cast<socklen_t>(size)) != nullptr;
+			freeaddrinfo(result);
+			return converted;
+		}
+	};
+
+	inline HostResolverCache& sharedSystemResolverCache()
+	{
+		static SystemHostResolver resolver;
+		static HostResolverCache cache(&resolver);
+		return cache;
+	}
+
+	// object adapter over the real linux socket api.
+	// destinations are "host:port", or just "host" to use the port given at construction
+	class AdapterLinux_UDP : public IUDPSendSocket
+	{
+	public:
+		static const size_t MaxBatch = 64;			// datagrams handed to a single sendmmsg
+		static const size_t MaxGsoSegments = 64;	// kernel limit for one segmented send
+		static const size_t MaxGsoBytes = 65507;	// payload of the biggest udp datagram
+
+		explicit AdapterLinux_UDP(unsigned short _defaultPort, HostResolverCache& _resolver = sharedSystemResolverCache())
+			: defaultPort(_defaultPort)
+			, resolver(_resolver)
+		{}
+
+		~AdapterLinux_UDP() override { close(); }
+
+		AdapterLinux_UDP(const AdapterLinux_UDP&) = delete;
+		AdapterLinux_UDP& operator=(const AdapterLinux_UDP&) = delete;
+
+		void open() override
+		{
+			close();
+			fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				return;
+
+			// setting a segment size of 0 is a no-op, it only tells whether the kernel knows about udp gso
+			int segment = 0;
+			gso = setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0;
+		}
+
+		void close() override
+		{
+			if (fd >= 0)
+				::close(fd);
+			fd = -1;
+			connectedHost.clear();
+		}
+
+		bool connect(const char* host) override
+		{
+			sockaddr_in destination;
+			if (fd < 0 || !address(host, destination)
+				|| ::connect(fd, reinterpret_cast<sockaddr*>(&destination), sizeof(destination)) != 0)
+				return false;
+
+			connectedHost = host;
+			return true;
+		}
+
+		bool isOpen() const { return fd >= 0; }
+		int nativeHandle() const { return fd; }
+		bool supportsSegmentation() const { return gso; }
+
+		void send(const char* host, const char* buffer, size_t size) override
+		{
+			if (fd >= 0 && !connectedHost.empty() && connectedHost == host)
+			{
+				::send(fd, buffer, size, 0);
+				return;
+			}
+
+			sockaddr_in destination;
+			if (fd < 0 || !address(host, destination))
+				return;
+
+			::sendto(fd, buffer, size, 0, reinterpret_cast<sockaddr*>(&destination), sizeof(destination));
+		}
+
+		// one sendmmsg per MaxBatch datagrams. stops at the first datagram the kernel refuses,
+		// datagrams to unresolvable hosts are dropped and not counted
+		size_t sendBatch(const Datagram* datagrams, size_t count) override
+		{
+			if (fd < 0)
+				return 0;
+
+			size_t sent = 0;
+			size_t next = 0;
+			while (next < count)
+			{
+				unsigned prepared = 0;
+				for (; next < count && prepared < MaxBatch; ++next)
+				{
+					if (!address(datagrams[next].host, addresses[prepared]))
+						continue;
+
+					vectors[prepared].iov_base = const_cast<char*>(datagrams[next].buffer);
+					vectors[prepared].iov_len = datagrams[next].size;
+
+					msghdr& header = messages[prepared].msg_hdr;
+					memset(&header, 0, sizeof(header));
+					header.msg_name = &addresses[prepared];
+					header.msg_namelen = sizeof(sockaddr_in);
+					header.msg_iov = &vectors[prepared];
+					header.msg_iovlen = 1;
+					++prepared;
+				}
+
+				unsigned done = 0;
+				while (done < prepared)
+				{
+					int result = ::sendmmsg(fd, messages + done, prepared - done, 0);
+					if (result < 0 && errno == EINTR)
+						continue;
+					if (result <= 0)
+						return sent + done;
+					done += static_cast<unsigned>(result);
+				}
+				sent += done;
+			}
+			return sent;
+		}
+
+		// sends buffer as consecutive datagrams of segmentSize bytes (the last one may be shorter) to a single host.
+		// with udp gso the kernel cuts the datagrams, up to MaxGsoSegments of them per syscall, otherwise falls back
+		// to sendBatch. returns the number of datagrams sent
+		size_t sendSegmented(const char* host, const char* buffer, size_t size, size_t segmentSize)
+		{
+			if (fd < 0 || segmentSize == 0 || segmentSize > MaxGsoBytes)
+				return 0;
+
+			size_t segments = (size + segmentSize - 1) / segmentSize;
+			if (!gso || segments == 1)
+			{
+				std::vector<Datagram> datagrams;
+				datagrams.reserve(segments);
+				for (size_t offset = 0; offset < size; offset += segmentSize)
+					datagrams.push_back(Datagram { host, buffer + offset, std::min(segmentSize, size - offset) });
+				return sendBatch(datagrams.data(), datagrams.size());
+			}
+
+			sockaddr_in destination;
+			if (!address(host, destination))
+				return 0;
+
+			size_t perSend = std::min(size_t(MaxGsoSegments), MaxGsoBytes / segmentSize);
+			size_t sent = 0;
+			for (size_t offset = 0; offset < size;)
+			{
+				size_t chunk = std::min(perSend * segmentSize, size - offset);
+				if (sendMessage(destination, buffer + offset, chunk, segmentSize, 0) < 0)
+					break;
+
+				sent += (chunk + segmentSize - 1) / segmentSize;
+				offset += chunk;
+			}
+			return sent;
+		}
+
+		// "host:port" or "host" to a socket address, the host part goes through the resolver cache
+		bool address(const char* destination, sockaddr_in& result)
+		{
+			char host[HostResolverCache::MaxHost];
+			unsigned short port = defaultPort;
+
+			const char* colon = strrchr(destination, ':');
+			size_t length = colon ? static_cast<size_t>(colon - destination) : strlen(destination);
+			if (length >= sizeof(host))
+				return false;
+			memcpy(host, destination, length);
+			host[length] = 0;
+			if (colon)
+				port = static_cast<unsigned short>(atoi(colon + 1));
+
+			char ip[HostResolverCache::MaxAddress];
+			if (!resolver.resolve(host, ip, sizeof(ip)))
+				return false;
+
+			memset(&result, 0, sizeof(result));
+			result.sin_family = AF_INET;
+			result.sin_port = htons(port);
+			return inet_pton(AF_INET, ip, &result.sin_addr) == 1;
+		}
+
+	protected:
+		// one sendmsg, cut into datagrams of segmentSize by the kernel unless segmentSize is 0. retries on EINTR
+		ssize_t sendMessage(const sockaddr_in& destination, const char* buffer, size_t size, size_t segmentSize, int flags)
+		{
+			iovec vector { const_cast<char*>(buffer), size };
+			char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+			msghdr header;
+			memset(&header, 0, sizeof(header));
+			header.msg_name = const_cast<sockaddr_in*>(&destination);
+			header.msg_namelen = sizeof(destination);
+			header.msg_iov = &vector;
+			header.msg_iovlen = 1;
+
+			if (segmentSize && gso && size > segmentSize)
+			{
+				header.msg_control = control;
+				header.msg_controllen = sizeof(control);
+
+				cmsghdr* message = CMSG_FIRSTHDR(&header);
+				message->cmsg_level = SOL_UDP;
+				message->cmsg_type = UDP_SEGMENT;
+				message->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				uint16_t segment = static_cast<uint16_t>(segmentSize);
+				memcpy(CMSG_DATA(message), &segment, sizeof(segment));
+			}
+
+			ssize_t result;
+			do
+			{
+				result = ::sendmsg(fd, &header, flags);
+			} while (result < 0 && errno == EINTR);
+			return result;
+		}
+
+	private:
+		int fd = -1;
+		bool gso = false;
+		unsigned short defaultPort;
+		HostResolverCache& resolver;
+		std::string connectedHost;
+
+		// scratch space of sendBatch, kept around to stay allocation free
+		mmsghdr messages[MaxBatch];
+		iovec vectors[MaxBatch];
+		sockaddr_in addresses[MaxBatch];
+	};
+
+	// packets per second over loopback: one send per datagram, sendBatch, and sendSegmented
+	inline void benchmarkUDPBatchSend(size_t packets, size_t payload)
+	{
+		int receiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+		sockaddr_in bound;
+		memset(&bound, 0, sizeof(bound));
+		bound.sin_family = AF_INET;
+		bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t boundSize = sizeof(bound);
+		if (receiver < 0 || ::bind(receiver, reinterpret_cast<sockaddr*>(&bound), sizeof(bound)) != 0
+			|| getsockname(receiver, reinterpret_cast<sockaddr*>(&bound), &boundSize) != 0)
+		{
+			std::cout << "benchmarkUDPBatchSend: no loopback socket" << std::endl;
+			return;
+		}
+
+		std::string destination = "127.0.0.1:" + std::to_string(ntohs(bound.sin_port));
+		AdapterLinux_UDP socket(0);
+		socket.open();
+
+		std::vector<char> data(packets * payload, 'x');
+		std::vector<IUDPSendSocket::Datagram> datagrams;
+		for (size_t i = 0; i < packets; ++i)
+			datagrams.push_back(IUDPSendSocket::Datagram { destination.c_str(), data.data() + i * payload, payload });
+
+		auto report = [packets](const char* label, size_t sent, std::chrono::steady_clock::time_point start)
+		{
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << label << double(packets) / seconds << " packets/s";
+			if (sent != packets)
+				std::cout << " (" << sent << " of " << packets << " sent)";
+			std::cout << std::endl;
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		for (auto& datagram : datagrams)
+			socket.send(datagram.host, datagram.buffer, datagram.size);
+		report("send          : ", packets, start);
+
+		start = std::chrono::steady_clock::now();
+		size_t sent = socket.sendBatch(datagrams.data(), datagrams.size());
+		report("sendBatch     : ", sent, start);
+
+		start = std::chrono::steady_clock::now();
+		sent = socket.sendSegmented(destination.c_str(), data.data(), data.size(), payload);
+		report(socket.supportsSegmentation() ? "sendSegmented : " : "sendSegmented (no gso): ", sent, start);
+
+		::close(receiver);
+	}
+}
+#endif
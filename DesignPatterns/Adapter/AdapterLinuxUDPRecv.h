@@ -0,0 +1,299 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include "Adapter.h"
+#include "PacketPool.h"
+
+#if defined(__linux__)
+#include "AdapterLinuxUDP.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace adapter_pattern
+{
+	// object adapter of the linux socket api to IUDPRecvSocket.
+	// every recvmmsg drains up to a whole batch of datagrams into buffers borrowed from a PacketPool, which go back to
+	// the pool as soon as the handler has seen them. nothing is allocated per packet. a datagram longer than a pool
+	// buffer arrives cut short, it is dropped and counted in truncated() instead of being delivered that way
+	class AdapterLinux_UDPRecv : public IUDPRecvSocket
+	{
+	public:
+		static const unsigned MaxBatch = 64;
+
+		// the pool may be shared by all the sockets drained from the same thread
+		explicit AdapterLinux_UDPRecv(PacketPool& _pool, unsigned _batch = MaxBatch)
+			: pool(_pool)
+			, batch(std::min(_batch ? _batch : 1, unsigned(MaxBatch)))
+		{}
+
+		~AdapterLinux_UDPRecv() override { close(); }
+
+		AdapterLinux_UDPRecv(const AdapterLinux_UDPRecv&) = delete;
+		AdapterLinux_UDPRecv& operator=(const AdapterLinux_UDPRecv&) = delete;
+
+		// port 0 picks a free one, see port()
+		bool open(unsigned short _port) override
+		{
+			close();
+			fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				return false;
+
+			int bufferSize = 8 * 1024 * 1024; // bursts have to fit in while we are busy with the previous batch
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+			sockaddr_in local;
+			memset(&local, 0, sizeof(local));
+			local.sin_family = AF_INET;
+			local.sin_addr.s_addr = htonl(INADDR_ANY);
+			local.sin_port = htons(_port);
+			socklen_t localSize = sizeof(local);
+			if (::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0
+				|| getsockname(fd, reinterpret_cast<sockaddr*>(&local), &localSize) != 0)
+			{
+				close();
+				return false;
+			}
+
+			m_port = ntohs(local.sin_port);
+			return true;
+		}
+
+		void close() override
+		{
+			if (fd >= 0)
+				::close(fd);
+			fd = -1;
+		}
+
+		size_t receive(const Handler& handler) override
+		{
+			return receive(handler, SIZE_MAX);
+		}
+
+		// budget bounds the work done in one call so a flooded socket can't starve the others of a multiplexer
+		size_t receive(const Handler& handler, size_t budget)
+		{
+			size_t delivered = 0;
+			size_t taken = 0; // delivered and dropped alike count against the budget
+			while (fd >= 0 && taken < budget)
+			{
+				unsigned prepared = 0;
+				size_t wanted = std::min<size_t>(batch, budget - taken);
+				for (; prepared < wanted; ++prepared)
+				{
+					char* packet = pool.acquire();
+					if (!packet)
+						break;
+
+					packets[prepared] = packet;
+					vectors[prepared].iov_base = packet;
+					vectors[prepared].iov_len = pool.packetSize();
+
+					msghdr& header = messages[prepared].msg_hdr;
+					memset(&header, 0, sizeof(header));
+					header.msg_name = &senders[prepared];
+					header.msg_namelen = sizeof(sockaddr_in);
+					header.msg_iov = &vectors[prepared];
+					header.msg_iovlen = 1;
+				}
+				if (prepared == 0)
+					break; // pool exhausted
+
+				int received = ::recvmmsg(fd, messages, prepared, MSG_DONTWAIT, nullptr);
+
+				for (int i = 0; i < received; ++i)
+				{
+					if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+					{
+						++m_truncated;
+						continue;
+					}
+					PacketView view { packets[i], messages[i].msg_len, ntohl(senders[i].sin_addr.s_addr), ntohs(senders[i].sin_port) };
+					handler.Invoke(view);
+					++delivered;
+				}
+				for (unsigned i = 0; i < prepared; ++i)
+					pool.release(packets[i]);
+
+				if (received <= 0)
+					break; // EAGAIN, nothing left
+				taken += static_cast<size_t>(received);
+				if (static_cast<unsigned>(received) < prepared)
+					break; // the queue ran dry within this batch
+			}
+			return delivered;
+		}
+
+		unsigned short port() const { return m_port; }
+		int nativeHandle() const { return fd; }
+
+		// datagrams dropped for not fitting a pool buffer
+		uint64_t truncated() const { return m_truncated; }
+
+	private:
+		PacketPool& pool;
+		unsigned batch;
+		int fd = -1;
+		unsigned short m_port = 0;
+		uint64_t m_truncated = 0;
+
+		// recvmmsg scratch space, allocated with the socket
+		mmsghdr messages[MaxBatch];
+		iovec vectors[MaxBatch];
+		sockaddr_in senders[MaxBatch];
+		char* packets[MaxBatch];
+	};
+
+	// waits for readiness on any number of receive sockets with one epoll set and drains the ready ones
+	class UDPRecvMultiplexer
+	{
+	public:
+		UDPRecvMultiplexer()
+			: epoll(epoll_create1(EPOLL_CLOEXEC))
+		{}
+
+		~UDPRecvMultiplexer()
+		{
+			if (epoll >= 0)
+				::close(epoll);
+		}
+
+		UDPRecvMultiplexer(const UDPRecvMultiplexer&) = delete;
+		UDPRecvMultiplexer& operator=(const UDPRecvMultiplexer&) = delete;
+
+		bool add(AdapterLinux_UDPRecv* socket, const IUDPRecvSocket::Handler& handler)
+		{
+			size_t index = 0;
+			while (index < sources.size() && sources[index].socket)
+				++index;
+			if (index == sources.size())
+				sources.push_back(Source());
+
+			epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN; // level triggered, a socket left with data after its budget comes back next time
+			event.data.u64 = index;
+			if (epoll_ctl(epoll, EPOLL_CTL_ADD, socket->nativeHandle(), &event) != 0)
+				return false;
+
+			sources[index] = Source { socket, handler };
+			return true;
+		}
+
+		void remove(AdapterLinux_UDPRecv* socket)
+		{
+			for (auto& source : sources)
+			{
+				if (source.socket != socket)
+					continue;
+				epoll_ctl(epoll, EPOLL_CTL_DEL, socket->nativeHandle(), nullptr);
+				source.socket = nullptr;
+			}
+		}
+
+		// waits up to timeoutMs (-1 forever, 0 not at all), returns the number of packets delivered
+		size_t poll(int timeoutMs, size_t budgetPerSocket = 1024)
+		{
+			epoll_event events[64];
+			int ready = epoll_wait(epoll, events, 64, timeoutMs);
+
+			size_t delivered = 0;
+			for (int i = 0; i < ready; ++i)
+			{
+				Source& source = sources[static_cast<size_t>(events[i].data.u64)];
+				if (source.socket)
+					delivered += source.socket->receive(source.handler, budgetPerSocket);
+			}
+			return delivered;
+		}
+
+	private:
+		struct Source
+		{
+			AdapterLinux_UDPRecv* socket;
+			IUDPRecvSocket::Handler handler;
+		};
+
+		int epoll;
+		std::vector<Source> sources;
+	};
+
+	// sender threads flood loopback with sendmmsg while this thread receives for a while,
+	// once with a recv per packet and once through the multiplexer and recvmmsg
+	inline void benchmarkUDPReceive(size_t payload, std::chrono::milliseconds duration, unsigned senderThreads = 3)
+	{
+		struct Counter
+		{
+			size_t packets = 0;
+			void onPacket(const IUDPRecvSocket::PacketView&) { ++packets; }
+		};
+
+		auto run = [&](bool batched)
+		{
+			PacketPool pool(1024, 2048);
+			AdapterLinux_UDPRecv receiver(pool);
+			if (!receiver.open(0))
+			{
+				std::cout << "benchmarkUDPReceive: can't bind" << std::endl;
+				return;
+			}
+
+			std::atomic<bool> sending { true };
+			std::vector<std::thread> senders;
+			for (unsigned t = 0; t < senderThreads; ++t)
+			{
+				senders.emplace_back([&]
+				{
+					AdapterLinux_UDP socket(receiver.port());
+					socket.open();
+					std::vector<char> data(payload, 'x');
+					std::vector<IUDPSendSocket::Datagram> datagrams(size_t(AdapterLinux_UDP::MaxBatch), IUDPSendSocket::Datagram { "127.0.0.1", data.data(), payload });
+					while (sending.load(std::memory_order_relaxed))
+						socket.sendBatch(datagrams.data(), datagrams.size());
+				});
+			}
+
+			Counter counter;
+			IUDPRecvSocket::Handler handler;
+			handler.Bind<Counter, &Counter::onPacket>(&counter);
+
+			UDPRecvMultiplexer multiplexer;
+			multiplexer.add(&receiver, handler);
+			std::vector<char> buffer(2048);
+
+			auto start = std::chrono::steady_clock::now();
+			while (std::chrono::steady_clock::now() - start < duration)
+			{
+				if (batched)
+				{
+					multiplexer.poll(10);
+				}
+				else
+				{
+					if (::recv(receiver.nativeHandle(), buffer.data(), buffer.size(), 0) > 0)
+						++counter.packets;
+				}
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			sending = false;
+			for (auto& sender : senders)
+				sender.join();
+
+			std::cout << (batched ? "epoll + recvmmsg : " : "recv per packet  : ") << double(counter.packets) / seconds << " packets/s" << std::endl;
+		};
+
+		run(false);
+		run(true);
+	}
+}
+#endif
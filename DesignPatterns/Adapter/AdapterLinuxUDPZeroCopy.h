@@ -0,0 +1,380 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include "Adapter.h"
+#include "PacketPool.h"
+
+#if defined(__linux__)
+#include "AdapterLinuxUDP.h"
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+
+// older libc headers know the kernel feature under no name
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+namespace adapter_pattern
+{
+	// AdapterLinux_UDP with buffers of its own: callers borrow one, serialize the packet right into it and hand it back
+	// through sendBuffer, no intermediate buffer and no copy on our side.
+	// payloads from zeroCopyThreshold on go out with MSG_ZEROCOPY, the kernel reads them straight from the buffer and
+	// tells on the error queue when it is done with them, only then does the buffer return to the pool. Smaller ones are
+	// cheaper to copy than to track and are recycled right away. owned by a single thread, like its pool
+	class AdapterLinux_UDPZeroCopy : public AdapterLinux_UDP
+	{
+	public:
+		// a borrowed packet buffer, the payload goes in data[0, size)
+		struct PacketBuffer
+		{
+			char* data = nullptr;
+			size_t capacity = 0;
+			size_t size = 0;
+		};
+
+		struct Stats
+		{
+			uint64_t zeroCopySends;
+			uint64_t copiedSends;		// under the threshold, without SO_ZEROCOPY or refused with ENOBUFS
+			uint64_t completions;
+			uint64_t kernelCopied;		// zero copy sends the kernel ended up copying anyway, e.g. over loopback
+			uint64_t abandoned;			// buffers still in flight at close, lost to the pool for good
+		};
+
+		AdapterLinux_UDPZeroCopy(unsigned short _defaultPort, size_t _buffers = 64, size_t _bufferSize = MaxGsoBytes,
+			size_t _zeroCopyThreshold = 16 * 1024, HostResolverCache& _resolver = sharedSystemResolverCache())
+			: AdapterLinux_UDP(_defaultPort, _resolver)
+			, pool(new PacketPool(_buffers, _bufferSize))
+			, threshold(_zeroCopyThreshold)
+		{
+			// pinned pages can't be paged out under a send in flight; best effort, RLIMIT_MEMLOCK is often small
+			pinned = mlock(pool->data(), pool->bytes()) == 0;
+		}
+
+		~AdapterLinux_UDPZeroCopy() override
+		{
+			close();
+
+			// the kernel may still read abandoned buffers, their memory has to stay as it is: the pool is leaked
+			if (counters.abandoned)
+				pool.release();
+			else if (pinned)
+				munlock(pool->data(), pool->bytes());
+		}
+
+		void open() override
+		{
+			AdapterLinux_UDP::open();
+			int enable = 1;
+			zeroCopy = isOpen() && setsockopt(nativeHandle(), SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+		}
+
+		// gives the kernel a moment to finish with the buffers still in flight. those it didn't get to are abandoned:
+		// their completions would arrive on the socket being closed, so nothing could tell when the kernel is done
+		// reading them and a send reusing one could rewrite a datagram still on its way. they never go back to the pool
+		void close() override
+		{
+			if (isOpen())
+				flush(100);
+			for (auto& send : pending)
+				if (send.buffer)
+					++counters.abandoned;
+			pending.clear();
+			firstPending = 0; // a new socket numbers its sends from 0 again
+			completedInQueue = 0;
+			AdapterLinux_UDP::close();
+		}
+
+		// a buffer of bufferSize bytes, data is nullptr when all of them are in use.
+		// an empty pool first collects the completed zero copy sends, then waits up to waitMs for more to complete
+		PacketBuffer acquireBuffer(int waitMs = 0)
+		{
+			PacketBuffer buffer;
+			buffer.data = pool->acquire();
+			if (!buffer.data && !pending.empty())
+			{
+				reapCompletions();
+				buffer.data = pool->acquire();
+				if (!buffer.data && waitMs != 0 && flush(waitMs, 1))
+					buffer.data = pool->acquire();
+			}
+			if (buffer.data)
+				buffer.capacity = pool->packetSize();
+			return buffer;
+		}
+
+		// hands a buffer that won't be sent back to the pool
+		void releaseBuffer(PacketBuffer& buffer)
+		{
+			if (buffer.data)
+				pool->release(buffer.data);
+			buffer = PacketBuffer();
+		}
+
+		// sends buffer.size bytes of the buffer as one datagram, or as datagrams of segmentSize bytes cut by udp gso.
+		// the buffer belongs to the socket afterwards, whether the send succeeded or not
+		bool sendBuffer(const char* host, PacketBuffer& buffer, size_t segmentSize = 0)
+		{
+			char* data = buffer.data;
+			size_t size = buffer.size;
+			buffer = PacketBuffer();
+			if (!data)
+				return false;
+
+			sockaddr_in destination;
+			if (!isOpen() || size > pool->packetSize() || !address(host, destination))
+			{
+				pool->release(data);
+				return false;
+			}
+
+			if (segmentSize && size > segmentSize && !supportsSegmentation())
+			{
+				bool sent = sendSegmented(host, data, size, segmentSize) > 0;
+				pool->release(data);
+				++counters.copiedSends;
+				return sent;
+			}
+
+			if (zeroCopy && size >= threshold)
+			{
+				if (sendMessage(destination, data, size, segmentSize, MSG_ZEROCOPY) >= 0)
+				{
+					// the kernel numbers the zero copy sends of a socket in order, starting at 0
+					pending.push_back(PendingSend { data });
+					++counters.zeroCopySends;
+					return true;
+				}
+				if (errno != ENOBUFS)
+				{
+					pool->release(data);
+					return false;
+				}
+				// out of optmem for completion records, copying still works
+			}
+
+			bool sent = sendMessage(destination, data, size, segmentSize, 0) >= 0;
+			pool->release(data);
+			++counters.copiedSends;
+			return sent;
+		}
+
+		// reads the completions queued on the socket without blocking and recycles the buffers they cover.
+		// returns the number of buffers recycled
+		size_t reapCompletions()
+		{
+			size_t recycled = 0;
+			while (isOpen() && !pending.empty())
+			{
+				char control[128];
+				msghdr header;
+				memset(&header, 0, sizeof(header));
+				header.msg_control = control;
+				header.msg_controllen = sizeof(control);
+
+				if (::recvmsg(nativeHandle(), &header, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					break; // EAGAIN, nothing queued
+				}
+
+				for (cmsghdr* message = CMSG_FIRSTHDR(&header); message; message = CMSG_NXTHDR(&header, message))
+				{
+					if (message->cmsg_level != SOL_IP || message->cmsg_type != IP_RECVERR)
+						continue;
+
+					sock_extended_err error;
+					memcpy(&error, CMSG_DATA(message), sizeof(error));
+					if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0)
+						continue;
+
+					// one notification covers the sends ee_info to ee_data, both included
+					for (uint32_t id = error.ee_info; id - error.ee_info <= error.ee_data - error.ee_info; ++id)
+						recycled += complete(id);
+					++counters.completions;
+					if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+						++counters.kernelCopied;
+				}
+			}
+			return recycled;
+		}
+
+		// waits up to timeoutMs (-1 forever) until at least atLeast buffers, or all pending ones, were recycled
+		bool flush(int timeoutMs, size_t atLeast = SIZE_MAX)
+		{
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+			size_t recycled = 0;
+			for (;;)
+			{
+				recycled += reapCompletions();
+				if (pending.empty() || recycled >= atLeast)
+					return true;
+
+				int wait = timeoutMs;
+				if (timeoutMs >= 0)
+				{
+					auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+					if (left <= 0)
+						return false;
+					wait = static_cast<int>(left);
+				}
+
+				// queued completions show up as POLLERR, which poll reports without being asked for
+				pollfd descriptor { nativeHandle(), 0, 0 };
+				::poll(&descriptor, 1, wait);
+			}
+		}
+
+		size_t pendingBuffers() const { return pending.size() - completedInQueue; }
+		size_t availableBuffers() const { return pool->available(); }
+		size_t bufferSize() const { return pool->packetSize(); }
+		bool supportsZeroCopy() const { return zeroCopy; }
+		bool buffersPinned() const { return pinned; }
+
+		Stats stats() const
+		{
+			return Stats { counters.zeroCopySends, counters.copiedSends, counters.completions, counters.kernelCopied, counters.abandoned };
+		}
+
+	private:
+		struct PendingSend
+		{
+			char* buffer; // nullptr once completed but still behind an older send
+		};
+
+		// completions may cover sends out of order, the front of the queue only moves past completed ones
+		size_t complete(uint32_t id)
+		{
+			size_t index = id - firstPending;
+			if (index >= pending.size() || !pending[index].buffer)
+				return 0;
+
+			pool->release(pending[index].buffer);
+			pending[index].buffer = nullptr;
+			++completedInQueue;
+
+			while (!pending.empty() && !pending.front().buffer)
+			{
+				pending.pop_front();
+				--completedInQueue;
+				++firstPending;
+			}
+			return 1;
+		}
+
+		std::unique_ptr<PacketPool> pool;
+		size_t threshold;
+		bool pinned = false;
+		bool zeroCopy = false;
+
+		std::deque<PendingSend> pending;
+		uint32_t firstPending = 0;	// notification id of pending.front(), wraps like the kernel's
+		size_t completedInQueue = 0;
+
+		struct Counters
+		{
+			uint64_t zeroCopySends = 0;
+			uint64_t copiedSends = 0;
+			uint64_t completions = 0;
+			uint64_t kernelCopied = 0;
+			uint64_t abandoned = 0;
+		} counters;
+	};
+
+	// cpu time per gigabyte handed to the socket, copying sendSegmented against buffers sent with MSG_ZEROCOPY.
+	// over loopback the kernel has to copy for the receiver anyway, the saving only shows on a real nic
+	inline void benchmarkZeroCopySend(size_t megabytes, size_t payload = 64 * 1024, size_t segmentSize = 1472)
+	{
+		int receiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+		sockaddr_in bound;
+		memset(&bound, 0, sizeof(bound));
+		bound.sin_family = AF_INET;
+		bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t boundSize = sizeof(bound);
+		if (receiver < 0 || ::bind(receiver, reinterpret_cast<sockaddr*>(&bound), sizeof(bound)) != 0
+			|| getsockname(receiver, reinterpret_cast<sockaddr*>(&bound), &boundSize) != 0)
+		{
+			std::cout << "benchmarkZeroCopySend: no loopback socket" << std::endl;
+			return;
+		}
+
+		std::string destination = "127.0.0.1:" + std::to_string(ntohs(bound.sin_port));
+		payload = std::min(payload, size_t(AdapterLinux_UDP::MaxGsoBytes) / segmentSize * segmentSize);
+		size_t sends = megabytes * 1024 * 1024 / payload;
+
+		auto cpuSeconds = []
+		{
+			rusage usage;
+			getrusage(RUSAGE_SELF, &usage);
+			return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+		};
+		auto report = [&](const char* label, double start)
+		{
+			double gigabytes = double(sends * payload) / (1024.0 * 1024.0 * 1024.0);
+			std::cout << label << (cpuSeconds() - start) / gigabytes << " cpu s/GB" << std::endl;
+		};
+
+		{
+			AdapterLinux_UDP socket(0);
+			socket.open();
+			std::vector<char> packet(payload);
+
+			double start = cpuSeconds();
+			for (size_t i = 0; i < sends; ++i)
+			{
+				memcpy(packet.data(), &i, sizeof(i)); // stands in for serializing the packet
+				socket.sendSegmented(destination.c_str(), packet.data(), payload, segmentSize);
+			}
+			report("copy      : ", start);
+		}
+
+		{
+			AdapterLinux_UDPZeroCopy socket(0, 64, payload, 16 * 1024);
+			socket.open();
+
+			double start = cpuSeconds();
+			for (size_t i = 0; i < sends; ++i)
+			{
+				AdapterLinux_UDPZeroCopy::PacketBuffer buffer = socket.acquireBuffer(-1);
+				if (!buffer.data)
+					break;
+				memcpy(buffer.data, &i, sizeof(i));
+				buffer.size = payload;
+				socket.sendBuffer(destination.c_str(), buffer, segmentSize);
+			}
+			socket.flush(1000);
+			report(socket.supportsZeroCopy() ? "zero copy : " : "zero copy (unsupported, copied) : ", start);
+
+			AdapterLinux_UDPZeroCopy::Stats stats = socket.stats();
+			std::cout << "  " << stats.zeroCopySends << " zero copy sends, " << stats.copiedSends << " copied, "
+				<< stats.kernelCopied << " of " << stats.completions << " completions copied by the kernel"
+				<< (socket.buffersPinned() ? "" : ", buffers not pinned") << std::endl;
+		}
+
+		::close(receiver);
+	}
+}
+#endif
@@ -0,0 +1,483 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+
+namespace adapter_pattern
+{
+	// anything able to turn a host name into an address string
+	class IHostResolver
+	{
+	public:
+		virtual ~IHostResolver() {}
+		virtual bool resolve(const char* host, char* buff, size_t size) = 0;
+	};
+
+	// local stand-in for name resolution, answers from a fixed table and counts how often it was asked
+	class StubHostResolver : public IHostResolver
+	{
+	public:
+		void add(const std::string& host, const std::string& address)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			table[host] = address;
+		}
+
+		void remove(const std::string& host)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			table.erase(host);
+		}
+
+		bool resolve(const char* host, char* buff, size_t size) override
+		{
+			++calls;
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = table.find(host);
+			if (found == table.end() || found->second.size() >= size)
+				return false;
+
+			memcpy(buff, found->second.c_str(), found->second.size() + 1);
+			return true;
+		}
+
+		std::atomic<uint64_t> calls { 0 };
+
+	private:
+		std::mutex mutex;
+		std::unordered_map<std::string, std::string> table;
+	};
+
+	struct HostResolverCacheConfig
+	{
+		std::chrono::milliseconds positiveTtl { 60 * 1000 };
+		std::chrono::milliseconds negativeTtl { 5 * 1000 };
+		size_t capacity = 1024;									// rounded up to a power of two
+
+		// a hit this close to expiry schedules a background refresh so hot hosts never miss. a refresh failing
+		// keeps the address it had and tries again negativeTtl later
+		bool asyncRefresh = false;
+		std::chrono::milliseconds refreshAhead { 5 * 1000 };
+
+		// nanoseconds the ttls are measured in, steady_clock when null. lets a check move time on by itself
+		int64_t (*now)() = nullptr;
+	};
+
+	// caches what an IHostResolver answers, failures included, for a limited time.
+	// lookups of cached hosts take no lock: entries live in a fixed open addressing table, each one guarded by a
+	// sequence counter which readers validate after copying. every field of a slot is an atomic, names and addresses
+	// as words, so the copy racing an insert is only torn, never undefined. misses resolve outside of any lock and
+	// insert under one. the counters are striped by thread, a hit only writes to its own thread's cache line
+	class HostResolverCache
+	{
+	public:
+		static const size_t MaxHost = 64;
+		static const size_t MaxAddress = 64;
+
+		struct Stats
+		{
+			uint64_t hits;
+			uint64_t negativeHits;
+			uint64_t misses;
+			uint64_t refreshes;
+		};
+
+		HostResolverCache(IHostResolver* _resolver, const HostResolverCacheConfig& _config = HostResolverCacheConfig())
+			: resolver(_resolver)
+			, config(_config)
+			, slots(roundUp(_config.capacity))
+		{}
+
+		~HostResolverCache()
+		{
+			if (refresher.joinable())
+			{
+				{
+					std::lock_guard<std::mutex> lock(refreshMutex);
+					stopping = true;
+				}
+				refreshWanted.notify_one();
+				refresher.join();
+			}
+		}
+
+		HostResolverCache(const HostResolverCache&) = delete;
+		HostResolverCache& operator=(const HostResolverCache&) = delete;
+
+		// same contract as BSDSocket::gethostbyname: writes the address into buff and returns false when unresolvable
+		bool resolve(const char* host, char* buff, size_t size)
+		{
+			size_t length = strlen(host);
+			if (length >= MaxHost || size == 0)
+				return resolver->resolve(host, buff, size); // too long to cache
+
+			Key key(host, length);
+			int64_t now = clock();
+
+			Entry entry;
+			Slot* slot = find(key, entry);
+			if (slot && entry.expires > now)
+			{
+				// the first reader to notice schedules the refresh, the others don't even look at the queue.
+				// failures are only retried once they expired
+				if (config.asyncRefresh && entry.resolved && entry.expires - now < milliseconds(config.refreshAhead)
+					&& !slot->refreshing.exchange(true, std::memory_order_relaxed))
+					scheduleRefresh(host);
+
+				if (!entry.resolved)
+				{
+					++localCounters().negativeHits;
+					return false;
+				}
+
+				++localCounters().hits;
+				size_t addressLength = strlen(entry.address);
+				if (addressLength >= size)
+					return false;
+				memcpy(buff, entry.address, addressLength + 1);
+				return true;
+			}
+
+			++localCounters().misses;
+			return refresh(key, buff, size);
+		}
+
+		Stats stats() const
+		{
+			Stats total {};
+			for (const Counters& stripe : counters)
+			{
+				total.hits += stripe.hits.load(std::memory_order_relaxed);
+				total.negativeHits += stripe.negativeHits.load(std::memory_order_relaxed);
+				total.misses += stripe.misses.load(std::memory_order_relaxed);
+				total.refreshes += stripe.refreshes.load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+	private:
+		static const size_t HostWords = MaxHost / 8;
+		static const size_t AddressWords = MaxAddress / 8;
+
+		struct Slot
+		{
+			std::atomic<uint32_t> sequence { 0 };	// odd while an insert is rewriting the slot
+			std::atomic<uint64_t> hash { 0 };		// 0 marks an empty slot
+			std::atomic<int64_t> expires { 0 };
+			std::atomic<bool> refreshing { false };
+			std::atomic<bool> resolved { false };
+			std::atomic<uint64_t> host[HostWords] = {};
+			std::atomic<uint64_t> address[AddressWords] = {};
+		};
+
+		// a host name as the slots keep it, zero padded words compared without strncmp
+		struct Key
+		{
+			Key(const char* _host, size_t _length)
+			{
+				memcpy(words, _host, _length);
+				memset(reinterpret_cast<char*>(words) + _length, 0, sizeof(words) - _length);
+				hash = hashOf(_host, _length);
+			}
+
+			const char* host() const { return reinterpret_cast<const char*>(words); }
+
+			bool matches(const Slot& slot) const
+			{
+				for (size_t i = 0; i < HostWords; ++i)
+					if (slot.host[i].load(std::memory_order_relaxed) != words[i])
+						return false;
+				return true;
+			}
+
+			uint64_t words[HostWords];
+			uint64_t hash;
+		};
+
+		struct Entry
+		{
+			int64_t expires;
+			bool resolved;
+			char address[MaxAddress];
+		};
+
+		static const size_t ProbeWindow = 8;
+
+		int64_t clock() const
+		{
+			if (config.now)
+				return config.now();
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		static int64_t milliseconds(std::chrono::milliseconds duration) { return duration.count() * 1000000; }
+
+		static size_t roundUp(size_t capacity)
+		{
+			size_t rounded = 16;
+			while (rounded < capacity)
+				rounded *= 2;
+			return rounded;
+		}
+
+		static uint64_t hashOf(const char* host, size_t length)
+		{
+			uint64_t hash = 14695981039346656037ull; // fnv-1a
+			for (size_t i = 0; i < length; ++i)
+				hash = (hash ^ static_cast<unsigned char>(host[i])) * 1099511628211ull;
+			return hash ? hash : 1;
+		}
+
+		Slot* find(const Key& key, Entry& entry)
+		{
+			size_t mask = slots.size() - 1;
+			for (size_t probe = 0; probe < ProbeWindow; ++probe)
+			{
+				Slot& slot = slots[(key.hash + probe) & mask];
+				for (;;)
+				{
+					uint32_t before = slot.sequence.load(std::memory_order_acquire);
+					if (before & 1)
+						continue; // insert in progress
+
+					uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+					if (slotHash == 0)
+						return nullptr;
+
+					bool match = slotHash == key.hash && key.matches(slot);
+					if (match)
+					{
+						uint64_t address[AddressWords];
+						for (size_t i = 0; i < AddressWords; ++i)
+							address[i] = slot.address[i].load(std::memory_order_relaxed);
+						entry.expires = slot.expires.load(std::memory_order_relaxed);
+						entry.resolved = slot.resolved.load(std::memory_order_relaxed);
+						memcpy(entry.address, address, MaxAddress);
+						entry.address[MaxAddress - 1] = 0;
+					}
+
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (slot.sequence.load(std::memory_order_relaxed) != before)
+						continue; // torn copy, read the slot again
+
+					if (match)
+						return &slot;
+					break;
+				}
+			}
+			return nullptr;
+		}
+
+		bool refresh(const Key& key, char* buff, size_t size)
+		{
+			char address[MaxAddress] = {};
+			bool resolved = resolver->resolve(key.host(), address, MaxAddress);
+			store(key, resolved, address, clock() + milliseconds(resolved ? config.positiveTtl : config.negativeTtl));
+
+			size_t addressLength = strlen(address);
+			if (!resolved || addressLength >= size)
+				return false;
+			memcpy(buff, address, addressLength + 1);
+			return true;
+		}
+
+		// a background refresh that failed keeps a positive entry still valid, only pushing its next try
+		// negativeTtl ahead. the miss path resolving it again decides once it really expired
+		void refreshInBackground(const Key& key)
+		{
+			char address[MaxAddress] = {};
+			if (resolver->resolve(key.host(), address, MaxAddress))
+			{
+				store(key, true, address, clock() + milliseconds(config.positiveTtl));
+				return;
+			}
+
+			Entry entry;
+			int64_t now = clock();
+			if (find(key, entry) && entry.resolved && entry.expires > now)
+				store(key, true, entry.address, std::max(entry.expires, now + milliseconds(config.refreshAhead + config.negativeTtl)));
+			else
+				store(key, false, address, now + milliseconds(config.negativeTtl));
+		}
+
+		void store(const Key& key, bool resolved, const char* address, int64_t expires)
+		{
+			std::lock_guard<std::mutex> lock(insertMutex);
+
+			// reuse the slot of the host, else an empty one, else the one closest to expiry
+			size_t mask = slots.size() - 1;
+			Slot* target = nullptr;
+			for (size_t probe = 0; probe < ProbeWindow; ++probe)
+			{
+				Slot& slot = slots[(key.hash + probe) & mask];
+				uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+				if (slotHash == key.hash && key.matches(slot))
+				{
+					target = &slot;
+					break;
+				}
+				if (slotHash == 0)
+				{
+					target = &slot;
+					break;
+				}
+				if (!target || slot.expires.load(std::memory_order_relaxed) < target->expires.load(std::memory_order_relaxed))
+					target = &slot;
+			}
+
+			uint32_t sequence = target->sequence.load(std::memory_order_relaxed);
+			target->sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			uint64_t addressWords[AddressWords] = {};
+			strncpy(reinterpret_cast<char*>(addressWords), address, MaxAddress - 1);
+
+			target->hash.store(key.hash, std::memory_order_relaxed);
+			target->expires.store(expires, std::memory_order_relaxed);
+			target->resolved.store(resolved, std::memory_order_relaxed);
+			for (size_t i = 0; i < HostWords; ++i)
+				target->host[i].store(key.words[i], std::memory_order_relaxed);
+			for (size_t i = 0; i < AddressWords; ++i)
+				target->address[i].store(addressWords[i], std::memory_order_relaxed);
+			target->refreshing.store(false, std::memory_order_relaxed);
+
+			target->sequence.store(sequence + 2, std::memory_order_release);
+		}
+
+		void scheduleRefresh(const char* host)
+		{
+			std::lock_guard<std::mutex> lock(refreshMutex);
+			refreshQueue.push_back(host);
+
+			if (!refresher.joinable())
+				refresher = std::thread([this] { refreshLoop(); });
+			refreshWanted.notify_one();
+		}
+
+		void refreshLoop()
+		{
+			std::unique_lock<std::mutex> lock(refreshMutex);
+			for (;;)
+			{
+				refreshWanted.wait(lock, [this] { return stopping || !refreshQueue.empty(); });
+				if (stopping)
+					return;
+
+				std::string host = refreshQueue.front();
+				refreshQueue.pop_front();
+				lock.unlock();
+
+				refreshInBackground(Key(host.c_str(), host.size()));
+				++localCounters().refreshes;
+
+				lock.lock();
+			}
+		}
+
+		IHostResolver* resolver;
+		HostResolverCacheConfig config;
+		std::vector<Slot> slots;
+		std::mutex insertMutex;
+
+		// a cache line each, threads are spread over them round robin
+		struct alignas(64) Counters
+		{
+			std::atomic<uint64_t> hits { 0 };
+			std::atomic<uint64_t> negativeHits { 0 };
+			std::atomic<uint64_t> misses { 0 };
+			std::atomic<uint64_t> refreshes { 0 };
+		};
+
+		static const size_t CounterStripes = 16;
+
+		Counters& localCounters()
+		{
+			static std::atomic<unsigned> nextStripe { 0 };
+			static thread_local unsigned stripe = nextStripe++ % CounterStripes;
+			return counters[stripe];
+		}
+
+		Counters counters[CounterStripes];
+
+		std::mutex refreshMutex;
+		std::condition_variable refreshWanted;
+		std::deque<std::string> refreshQueue;
+		bool stopping = false;
+		std::thread refresher;
+	};
+
+	// the cache against a StubHostResolver on a clock it moves itself: a hit not asking the resolver, expiry,
+	// a cached failure and a failed background refresh keeping the address it had. asserts on every case
+	inline void checkHostResolverCache()
+	{
+		static std::atomic<int64_t> now { 0 };
+		auto advance = [](std::chrono::milliseconds duration) { now += duration.count() * 1000000; };
+
+		StubHostResolver stub;
+		stub.add("game.example", "10.0.0.1");
+		char address[HostResolverCache::MaxAddress];
+
+		HostResolverCacheConfig config;
+		config.positiveTtl = std::chrono::milliseconds(50);
+		config.negativeTtl = std::chrono::milliseconds(20);
+		config.now = [] { return now.load(); };
+		{
+			// hit answered without the resolver
+			HostResolverCache cache(&stub, config);
+			bool resolved = cache.resolve("game.example", address, sizeof(address));
+			assert(resolved && stub.calls == 1);
+			resolved = cache.resolve("game.example", address, sizeof(address));
+			assert(resolved && strcmp(address, "10.0.0.1") == 0 && stub.calls == 1);
+			assert(cache.stats().hits == 1 && cache.stats().misses == 1);
+
+			// expired entry resolved again
+			stub.add("game.example", "10.0.0.2");
+			advance(config.positiveTtl);
+			resolved = cache.resolve("game.example", address, sizeof(address));
+			assert(resolved && strcmp(address, "10.0.0.2") == 0 && stub.calls == 2);
+
+			// failure cached
+			resolved = cache.resolve("gone.example", address, sizeof(address));
+			assert(!resolved && stub.calls == 3);
+			resolved = cache.resolve("gone.example", address, sizeof(address));
+			assert(!resolved && stub.calls == 3 && cache.stats().negativeHits == 1);
+
+			// cached failure expires
+			advance(config.negativeTtl);
+			stub.add("gone.example", "10.0.0.3");
+			resolved = cache.resolve("gone.example", address, sizeof(address));
+			assert(resolved && strcmp(address, "10.0.0.3") == 0 && stub.calls == 4);
+			(void)resolved;
+		}
+
+		config.positiveTtl = std::chrono::milliseconds(200);
+		config.refreshAhead = std::chrono::milliseconds(150);
+		config.asyncRefresh = true;
+		{
+			// the resolver fails from now on, the hit inside refreshAhead has the refresh fail in the background
+			HostResolverCache cache(&stub, config);
+			cache.resolve("game.example", address, sizeof(address));
+			stub.remove("game.example");
+			advance(std::chrono::milliseconds(60));
+			cache.resolve("game.example", address, sizeof(address));
+			while (cache.stats().refreshes == 0)
+				std::this_thread::yield();
+
+			// failed refresh keeps the address
+			bool resolved = cache.resolve("game.example", address, sizeof(address));
+			assert(resolved && strcmp(address, "10.0.0.2") == 0 && stub.calls == 6);
+			(void)resolved;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+namespace adapter_pattern
+{
+	// fixed number of equally sized packet buffers carved out of one allocation up front.
+	// acquire and release are O(1) pops and pushes on a free list, nothing is allocated once the pool exists.
+	// owned by a single thread
+	class PacketPool
+	{
+	public:
+		static const size_t Alignment = 64; // no two packets share a cache line
+
+		PacketPool(size_t _count, size_t _packetSize)
+			: m_packetSize((std::max<size_t>(_packetSize, 1) + Alignment - 1) / Alignment * Alignment)
+			, storage(_count * m_packetSize + Alignment)
+		{
+			// the vector only guarantees the alignment of its element type
+			uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+			base = storage.data() + (Alignment - address % Alignment) % Alignment;
+
+			freeList.reserve(_count);
+			for (size_t i = _count; i > 0; --i)
+				freeList.push_back(static_cast<uint32_t>(i - 1));
+		}
+
+		PacketPool(const PacketPool&) = delete;
+		PacketPool& operator=(const PacketPool&) = delete;
+
+		// nullptr when every packet is in use
+		char* acquire()
+		{
+			if (freeList.empty())
+				return nullptr;
+
+			uint32_t index = freeList.back();
+			freeList.pop_back();
+			return base + index * m_packetSize;
+		}
+
+		void release(char* packet)
+		{
+			assert(owns(packet) && "packet doesn't belong to this pool");
+			freeList.push_back(static_cast<uint32_t>((packet - base) / m_packetSize));
+		}
+
+		bool owns(const char* packet) const
+		{
+			return packet >= base && packet < base + capacity() * m_packetSize && (packet - base) % m_packetSize == 0;
+		}
+
+		size_t packetSize() const { return m_packetSize; }
+		size_t capacity() const { return (storage.size() - Alignment) / m_packetSize; }
+		size_t available() const { return freeList.size(); }
+
+		// the whole region, for apis that want to register or pin it in one go
+		char* data() { return base; }
+		size_t bytes() const { return capacity() * m_packetSize; }
+
+	private:
+		size_t m_packetSize;
+		std::vector<char> storage;
+		char* base;
+		std::vector<uint32_t> freeList;
+	};
+}
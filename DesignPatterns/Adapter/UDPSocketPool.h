@@ -0,0 +1,264 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+namespace adapter_pattern
+{
+	struct UDPSocketPoolConfig
+	{
+		std::chrono::milliseconds idleTimeout { 30 * 1000 };	// sockets unused for this long get closed
+		size_t threadCacheSize = 8;								// destinations each thread remembers without locking
+	};
+
+	// process wide set of open sockets, one per destination, each connected to its host.
+	// every thread keeps the sockets it used last in a small cache of its own, so sending to a hot destination takes
+	// no lock. the shared table, and its lock, are only visited by a thread for destinations it hasn't cached.
+	// a cached send writes nothing shared: the caches hold their sockets, and check one pool wide eviction epoch
+	// instead of counting references per send. an evicted socket is closed once the table and every thread cache
+	// that had it have let go, caches let go on their thread's next send through the pool (or when it exits).
+	// Socket is any IUDPSendSocket safe to send on from several threads at once
+	template <class Socket>
+	class UDPSocketPool
+	{
+	public:
+		using Factory = std::function<Socket*()>;
+
+		struct Stats
+		{
+			uint64_t sharedHits;		// destinations a thread had to look up in the shared table
+			uint64_t socketsOpened;
+			uint64_t socketsEvicted;
+		};
+
+		explicit UDPSocketPool(Factory _factory = &UDPSocketPool::createDefault, const UDPSocketPoolConfig& _config = UDPSocketPoolConfig())
+			: factory(std::move(_factory))
+			, config(_config)
+			, id(nextId())
+			, alive(std::make_shared<bool>(true))
+			, lastEviction(now())
+		{}
+
+		UDPSocketPool(const UDPSocketPool&) = delete;
+		UDPSocketPool& operator=(const UDPSocketPool&) = delete;
+
+		static UDPSocketPool& shared()
+		{
+			static UDPSocketPool pool;
+			return pool;
+		}
+
+		void send(const char* host, const char* buffer, size_t size)
+		{
+			Entry* entry = acquire(host);
+			if (entry)
+				entry->socket->send(host, buffer, size);
+		}
+
+		// evicts sockets nobody sent on for idleTimeout, see above for when they close. runs by itself now and then
+		// when a thread misses its cache
+		size_t evictIdle()
+		{
+			int64_t deadline = now() - idleTimeoutTicks();
+			size_t evicted = 0;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto it = entries.begin(); it != entries.end();)
+			{
+				if (it->second->lastUsed.load(std::memory_order_relaxed) < deadline)
+				{
+					it->second->evicted.store(true, std::memory_order_relaxed);
+					it = entries.erase(it);
+					++evicted;
+				}
+				else
+				{
+					++it;
+				}
+			}
+
+			if (evicted)
+				epoch.fetch_add(1, std::memory_order_release);
+			counters.socketsEvicted += evicted;
+			lastEviction.store(now(), std::memory_order_relaxed);
+			return evicted;
+		}
+
+		size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return entries.size();
+		}
+
+		Stats stats() const
+		{
+			return Stats { counters.sharedHits.load(), counters.socketsOpened.load(), counters.socketsEvicted.load() };
+		}
+
+	private:
+		struct Entry
+		{
+			~Entry()
+			{
+				if (socket)
+					socket->close();
+			}
+
+			std::string host;
+			std::unique_ptr<Socket> socket;
+			std::atomic<int64_t> lastUsed { 0 };
+			std::atomic<bool> evicted { false };
+		};
+
+		// what a thread remembers of one pool. pools are told apart by an id never handed out twice, a pool created
+		// where a destroyed one was isn't mistaken for it, and the cache of a destroyed pool goes when its token does
+		struct ThreadCache
+		{
+			uint64_t pool;
+			std::weak_ptr<bool> alive;
+			uint64_t epoch;								// of the pool when the entries were last checked for eviction
+			std::vector<std::shared_ptr<Entry>> entries;	// most recently used first
+		};
+
+		static Socket* createDefault() { return new Socket(); }
+
+		static uint64_t nextId()
+		{
+			static std::atomic<uint64_t> ids { 0 };
+			return ++ids;
+		}
+
+		// coarse clock in milliseconds, precise enough to tell idle sockets apart
+		static int64_t now()
+		{
+			return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		int64_t idleTimeoutTicks() const { return config.idleTimeout.count(); }
+
+		// the entry stays valid until this thread's next acquire, its cache holds it
+		Entry* acquire(const char* host)
+		{
+			ThreadCache& cache = threadCache();
+
+			// entries only leave the cache once the pool evicted some, not on every send
+			uint64_t current = epoch.load(std::memory_order_acquire);
+			if (cache.epoch != current)
+			{
+				for (std::shared_ptr<Entry>& entry : cache.entries)
+					if (entry && entry->evicted.load(std::memory_order_relaxed))
+						entry.reset();
+				cache.epoch = current;
+			}
+
+			// the array is tiny, a linear scan beats any hashing
+			int64_t time = now();
+			std::vector<std::shared_ptr<Entry>>& entries = cache.entries;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				Entry* entry = entries[i].get();
+				if (!entry || entry->host != host)
+					continue;
+
+				// only write the shared timestamp when it moved, many threads hitting one socket shouldn't fight over it
+				if (entry->lastUsed.load(std::memory_order_relaxed) != time)
+					entry->lastUsed.store(time, std::memory_order_relaxed);
+
+				if (i != 0)
+					std::swap(entries[0], entries[i]);
+				return entry;
+			}
+
+			std::shared_ptr<Entry> entry = lookup(host, time);
+			if (!entry)
+				return nullptr;
+
+			// the least recently used cached destination makes room
+			for (size_t i = entries.size() - 1; i > 0; --i)
+				entries[i] = std::move(entries[i - 1]);
+			entries[0] = std::move(entry);
+
+			if (time - lastEviction.load(std::memory_order_relaxed) > idleTimeoutTicks() / 2)
+				evictIdle();
+			return entries[0].get();
+		}
+
+		// this thread's cache for this pool, sized by its config. the caches of destroyed pools are dropped on the
+		// way to creating a new one
+		ThreadCache& threadCache()
+		{
+			static thread_local std::vector<ThreadCache> caches;
+			for (ThreadCache& cache : caches)
+				if (cache.pool == id)
+					return cache;
+
+			for (size_t i = 0; i < caches.size();)
+			{
+				if (caches[i].alive.expired())
+				{
+					caches[i] = std::move(caches.back());
+					caches.pop_back();
+				}
+				else
+					++i;
+			}
+			size_t size = config.threadCacheSize ? config.threadCacheSize : 1;
+			caches.push_back(ThreadCache { id, alive, epoch.load(std::memory_order_acquire), std::vector<std::shared_ptr<Entry>>(size) });
+			return caches.back();
+		}
+
+		std::shared_ptr<Entry> lookup(const char* host, int64_t time)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto found = entries.find(host);
+				if (found != entries.end())
+				{
+					found->second->lastUsed.store(time, std::memory_order_relaxed);
+					++counters.sharedHits;
+					return found->second;
+				}
+			}
+
+			// socket setup happens outside the lock, should two threads race for a new host the loser's socket is dropped
+			std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+			entry->host = host;
+			entry->socket.reset(factory());
+			if (!entry->socket)
+				return nullptr;
+			entry->socket->open();
+			entry->socket->connect(host);
+			entry->lastUsed.store(time, std::memory_order_relaxed);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			auto inserted = entries.emplace(entry->host, entry);
+			if (inserted.second)
+				++counters.socketsOpened;
+			return inserted.first->second;
+		}
+
+		Factory factory;
+		UDPSocketPoolConfig config;
+		uint64_t id;
+		std::shared_ptr<bool> alive;	// expires with the pool, for the thread caches to drop theirs
+
+		mutable std::mutex mutex;
+		std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+		std::atomic<int64_t> lastEviction;
+		std::atomic<uint64_t> epoch { 0 };	// bumped by every eviction that took something out
+
+		struct Counters
+		{
+			std::atomic<uint64_t> sharedHits { 0 };
+			std::atomic<uint64_t> socketsOpened { 0 };
+			std::atomic<uint64_t> socketsEvicted { 0 };
+		} counters;
+	};
+}
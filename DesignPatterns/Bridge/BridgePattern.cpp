@@ -4,34 +4,34 @@
 namespace bridge_pattern
 {
 	// can be kept in some other file not visible to the client
-	class SystemDialogImpl_PS4 : public SystemDialogImpl
+	class SystemDialogImpl_PS4 final : public SystemDialogImpl
 	{
 		void render() override {}
 		void setAnimData(const AnimData& data) override {}
+		void submit(const RenderCommandBuffer& commands) override {}
 	};
 
-	class SystemDialogImpl_X1 : public SystemDialogImpl
+	class SystemDialogImpl_X1 final : public SystemDialogImpl
 	{
 		void render() override {}
 		void setAnimData(const AnimData& data) override {}
+		void submit(const RenderCommandBuffer& commands) override {}
 	};
 
-	class SystemDialogImpl_NX : public SystemDialogImpl
+	class SystemDialogImpl_NX final : public SystemDialogImpl
 	{
 		void render() override {}
 		void setAnimData(const AnimData& data) override {}
+		void submit(const RenderCommandBuffer& commands) override {}
 	};
 
-	void SystemDialog::setXYWH(float _x, float _y, float _w, float _h)
-	{
-		x = _x;
-		y = _y;
-		w = _w;
-		h = _h;
-	}
-
 	void SystemDialog::render()
 	{
+		if (impl)
+		{
+			impl->render();
+			return;
+		}
 		std::cout << "running SystemDialog::render()" << std::endl;
 	}
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
 
 namespace bridge_pattern
 {
@@ -50,42 +53,385 @@ namespace bridge_pattern
 		// solution follows below 
 	} //------------------------------------------------------------------------------------------------------------------
 
+	struct DialogRect
+	{
+		float x, y, w, h;
+
+		bool empty() const { return w <= 0 || h <= 0; }
+
+		bool intersects(const DialogRect& other) const
+		{
+			return !empty() && !other.empty() && x < other.x + other.w && other.x < x + w && y < other.y + other.h && other.y < y + h;
+		}
+
+		DialogRect merged(const DialogRect& other) const
+		{
+			if (empty())
+				return other;
+			if (other.empty())
+				return *this;
+			float left = std::min(x, other.x), top = std::min(y, other.y);
+			return DialogRect { left, top, std::max(x + w, other.x + other.w) - left, std::max(y + h, other.y + other.h) - top };
+		}
+	};
+
+	// one thing to draw, recorded by a dialog into the frame's RenderCommandBuffer. plain data, no pointers
+	struct RenderCommand
+	{
+		enum class Type : uint8_t { Clear, Panel, Text, Animation };	// a frame with Clears draws only inside their rects
+
+		Type type;
+		uint8_t align;		// SystemDialog::Align
+		uint8_t layer;		// drawn in order of layer, dialogs on top go on a higher one
+		uint16_t band;		// set by the buffer, see RenderCommandBuffer::beginDialog
+		uint32_t textOffset;	// into the buffer's text, for Text
+		uint32_t textLength;
+		float x, y, w, h;
+
+		// what a backend has to switch between commands. layer and band first, so sorting never changes what ends up on top
+		uint32_t state() const { return uint32_t(layer) << 20 | uint32_t(band) << 4 | uint32_t(type) << 2 | align; }
+
+		static RenderCommand make(Type type, uint8_t align, uint8_t layer, float x, float y, float w, float h)
+		{
+			RenderCommand command {};
+			command.type = type;
+			command.align = align;
+			command.layer = layer;
+			command.x = x;
+			command.y = y;
+			command.w = w;
+			command.h = h;
+			return command;
+		}
+	};
+
+	// everything the dialogs draw in a frame, filed by state as it is recorded: sorting the frame comes down to
+	// sorting its few distinct states. the arrays of the states in use keep their memory from frame to frame.
+	// filing by state alone would draw all the panels of a layer before all its texts, the text of one dialog over
+	// the panel of another on top of it. so each dialog starts with beginDialog, which puts it on a band of its layer
+	// above every dialog recorded before it that it overlaps: within a layer bands are drawn in order, and dialogs
+	// that don't overlap share a band and batch together
+	class RenderCommandBuffer
+	{
+	public:
+		RenderCommandBuffer() : binOf(256), cells(CellCount) {}
+
+		void reset()
+		{
+			pruneBins();
+			text.clear();
+			count = 0;
+			band = 0;
+			++frame; // empties the cells
+		}
+
+		// the commands pushed from here on belong to a dialog covering rect on layer
+		void beginDialog(const DialogRect& rect, uint8_t layer)
+		{
+			band = 0;
+			if (rect.empty())
+				return;
+
+			touched.clear();
+			int x0 = cellOf(rect.x), x1 = cellOf(rect.x + rect.w), y0 = cellOf(rect.y), y1 = cellOf(rect.y + rect.h);
+			for (int y = y0; y <= y1; ++y)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					// cells are hashed, one may hold dialogs of other cells and layers: the rect test sorts them out
+					Cell& cell = cellAt(layer, x, y);
+					for (const Placed& placed : cell.placed)
+						if (placed.band >= band && placed.layer == layer && placed.rect.intersects(rect))
+							band = placed.band == UINT16_MAX ? UINT16_MAX : uint16_t(placed.band + 1);
+					touched.push_back(&cell);
+				}
+			}
+			for (Cell* cell : touched)
+				cell->placed.push_back(Placed { rect, layer, band });
+		}
+
+		void push(RenderCommand command)
+		{
+			command.band = band;
+			uint32_t state = command.state();
+			uint16_t& bin = binSlot(state);
+			if (bin == NoBin)
+			{
+				bin = static_cast<uint16_t>(bins.size());
+				bins.push_back(Bin { state, std::vector<RenderCommand>() });
+				sorted = false;
+			}
+			bins[bin].commands.push_back(command);
+			++count;
+		}
+
+		void pushText(RenderCommand command, const std::string& string)
+		{
+			command.textOffset = static_cast<uint32_t>(text.size());
+			command.textLength = static_cast<uint32_t>(string.size());
+			text.insert(text.end(), string.begin(), string.end());
+			push(command);
+		}
+
+		// puts the states in order, only does anything in a frame that brought new ones
+		void sort()
+		{
+			if (sorted)
+				return;
+			std::sort(bins.begin(), bins.end(), [](const Bin& a, const Bin& b) { return a.state < b.state; });
+			for (size_t i = 0; i < bins.size(); ++i)
+				binSlot(bins[i].state) = static_cast<uint16_t>(i);
+			sorted = true;
+		}
+
+		// f(command) state by state, in the order of the states once sorted. commands of a state come as recorded
+		template <class F>
+		void forEach(F&& f) const
+		{
+			for (const Bin& bin : bins)
+				for (const RenderCommand& command : bin.commands)
+					f(command);
+		}
+
+		const char* textOf(const RenderCommand& command) const { return text.data() + command.textOffset; }
+		size_t size() const { return count; }
+
+	private:
+		static const uint16_t NoBin = UINT16_MAX;
+		static const size_t CellCount = 1024;
+		static constexpr float CellSize = 128;
+
+		struct Bin
+		{
+			uint32_t state;
+			std::vector<RenderCommand> commands;
+		};
+
+		// a dialog recorded this frame, in every cell its rect touches
+		struct Placed
+		{
+			DialogRect rect;
+			uint8_t layer;
+			uint16_t band;
+		};
+
+		struct Cell
+		{
+			uint32_t frame = 0;
+			std::vector<Placed> placed;
+		};
+
+		// drops the bins of the states the frame didn't use and empties the others, which keep their memory. a frame of
+		// deep overlap would otherwise leave hundreds of empty bins for every later one to walk through, and its tables
+		// are cut back once the bands of their layer no longer reach as far
+		void pruneBins()
+		{
+			uint32_t needed[256] = {};	// by layer, how far into its table the bins kept go
+			size_t kept = 0;
+			for (size_t i = 0; i < bins.size(); ++i)
+			{
+				if (bins[i].commands.empty())
+				{
+					binSlot(bins[i].state) = NoBin;
+					continue;
+				}
+				if (kept != i)
+					bins[kept] = std::move(bins[i]);
+				Bin& bin = bins[kept];
+				bin.commands.clear();
+				binSlot(bin.state) = static_cast<uint16_t>(kept); // still in order, sorting isn't needed again
+				needed[bin.state >> 20] = std::max(needed[bin.state >> 20], (bin.state & 0xFFFFF) + 1);
+				++kept;
+			}
+			bins.erase(bins.begin() + kept, bins.end());
+
+			for (size_t layer = 0; layer < binOf.size(); ++layer)
+			{
+				std::vector<uint16_t>& table = binOf[layer];
+				if (table.size() > 2 * needed[layer] + 256)
+				{
+					table.resize(needed[layer]);
+					table.shrink_to_fit();
+				}
+			}
+		}
+
+		// the bin of a state, by layer and then by the rest of it. a table only grows as far as the bands of its layer go
+		uint16_t& binSlot(uint32_t state)
+		{
+			std::vector<uint16_t>& table = binOf[state >> 20];
+			uint32_t index = state & 0xFFFFF;
+			if (index >= table.size())
+				table.resize(index + 1, uint16_t(NoBin));
+			return table[index];
+		}
+
+		// floor without the library call, coordinates left of or above the origin included
+		static int cellOf(float coordinate)
+		{
+			float scaled = coordinate * (1 / CellSize);
+			int truncated = static_cast<int>(scaled);
+			return truncated - (scaled < float(truncated));
+		}
+
+		Cell& cellAt(uint8_t layer, int x, int y)
+		{
+			uint32_t hash = (uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (uint32_t(layer) * 83492791u);
+			Cell& cell = cells[hash & (CellCount - 1)];
+			if (cell.frame != frame)
+			{
+				cell.frame = frame;
+				cell.placed.clear();
+			}
+			return cell;
+		}
+
+		std::vector<Bin> bins;						// the states of this frame and of the last, see pruneBins
+		std::vector<std::vector<uint16_t>> binOf;	// by layer, then by state
+		std::vector<char> text;
+		size_t count = 0;
+		bool sorted = true;
+
+		std::vector<Cell> cells;	// where this frame's dialogs are, for their bands
+		std::vector<Cell*> touched;	// by the dialog beginDialog places
+		uint32_t frame = 1;
+		uint16_t band = 0;
+	};
+
 	class SystemDialogImpl
 	{
 	public:
 		struct AnimData {};
 
+		virtual ~SystemDialogImpl() {}
 		virtual void render() = 0;
 		virtual void setAnimData(const AnimData& data) = 0;
+
+		// the whole frame in one call, binding each state once for the commands that share it
+		virtual void submit(const RenderCommandBuffer& commands) = 0;
 	};
 
-	// it seems a bridge design pattern has better options for us
-	class SystemDialog
+	class DialogState;
+
+	// told when a dialog changes what it draws, once until the dialog is marked clean again
+	class DialogListener
 	{
 	public:
+		virtual ~DialogListener() {}
+		virtual void dialogChanged(DialogState& dialog) = 0;
+	};
 
-		virtual ~SystemDialog() {}
-
+	// what a dialog is and draws, whichever way it reaches its backend. no virtual functions, so SystemDialog and
+	// StaticSystemDialog share it without the static one paying for a vtable
+	class DialogState
+	{
+	public:
 		enum class Align { Left, Center, Right };
 
-		virtual void open(Align align) { alignment = align; }
-		virtual void close() { kill = true; }
-		void setText(const char* txt) { text = txt; }
-		void setXYWH(float _x, float _y, float _w, float _h);
+		void open(Align align) { alignment = align; markDirty(); }
+		void close() { kill = true; markDirty(); }
+		void setText(const char* txt) { text = txt; markDirty(); }
+		void setLayer(uint8_t _layer) { layer = _layer; markDirty(); }
 
-		virtual void render();
+		void setXYWH(float _x, float _y, float _w, float _h)
+		{
+			x = _x;
+			y = _y;
+			w = _w;
+			h = _h;
+			markDirty();
+		}
+
+		DialogRect rect() const { return DialogRect { x, y, w, h }; }
+		uint8_t getLayer() const { return layer; }
+		bool isClosed() const { return kill; }
+
+		// changes since the listener last marked the dialog clean. the setters mark it dirty themselves
+		bool isDirty() const { return dirty; }
+		void markClean() { dirty = false; }
+
+		void markDirty()
+		{
+			if (dirty)
+				return;
+			dirty = true;
+			if (listener)
+				listener->dialogChanged(*this);
+		}
+
+		void setListener(DialogListener* _listener) { listener = _listener; }
+
+		// back to how a new dialog starts, the text keeps its memory and the listener stays. so does the animation,
+		// which comes with the kind of dialog
+		void reset()
+		{
+			kill = false;
+			alignment = Align::Left;
+			layer = 0;
+			x = y = w = h = 0;
+			text.clear();
+			dirty = false;
+		}
+
+		// what render() would draw, as commands for the backend to take with the rest of the frame
+		void record(RenderCommandBuffer& commands) const
+		{
+			if (kill)
+				return;
+			commands.beginDialog(rect(), layer);
+			commands.push(command(RenderCommand::Type::Panel));
+			if (!text.empty())
+				commands.pushText(command(RenderCommand::Type::Text), text);
+			if (animated)
+				commands.push(command(RenderCommand::Type::Animation));
+		}
 
 	protected:
-		bool kill;
-		Align alignment;
-		float x, y, w, h;
+		DialogState() = default;
+		~DialogState() = default;
+
+		RenderCommand command(RenderCommand::Type type) const
+		{
+			return RenderCommand::make(type, static_cast<uint8_t>(alignment), layer, x, y, w, h);
+		}
+
+		bool kill = false;
+		bool animated = false;
+		Align alignment = Align::Left;
+		uint8_t layer = 0;
+		float x = 0, y = 0, w = 0, h = 0;
 		std::string text;
 
+	private:
+		bool dirty = false;
+		DialogListener* listener = nullptr;
+	};
+
+	// it seems a bridge design pattern has better options for us
+	class SystemDialog : public DialogState
+	{
+	public:
+		using Backend = SystemDialogImpl;
+
+		explicit SystemDialog(SystemDialogImpl* _impl = nullptr) : impl(_impl) {}
+		virtual ~SystemDialog() {}
+
+		virtual void open(Align align) { DialogState::open(align); }
+		virtual void close() { DialogState::close(); }
+
+		virtual void render();
+		virtual void record(RenderCommandBuffer& commands) const { DialogState::record(commands); }
+
+	protected:
 		SystemDialogImpl* impl; // impl connecting SystemDialog to SystemDialogImpl marks the bridge
 	};
 
 	class SystemDialogWithAnim: public SystemDialog
 	{
+	public:
+		explicit SystemDialogWithAnim(SystemDialogImpl* _impl = nullptr) : SystemDialog(_impl) { animated = true; }
+
+	private:
 		void open()
 		{
 			SystemDialog::open(Align::Center);
@@ -93,4 +439,14 @@ namespace bridge_pattern
 			impl->setAnimData(data);
 		}
 	};
-}
\ No newline at end of file
+
+	// a frame of dialogs: recorded, sorted and handed to the backend in one go
+	inline void renderBatched(const std::vector<SystemDialog*>& dialogs, RenderCommandBuffer& commands, SystemDialogImpl& backend)
+	{
+		commands.reset();
+		for (const SystemDialog* dialog : dialogs)
+			dialog->record(commands);
+		commands.sort();
+		backend.submit(commands);
+	}
+}
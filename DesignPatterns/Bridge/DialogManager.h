@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "BridgePattern.h"
+#include "HeadlessDialogImpl.h"
+
+namespace bridge_pattern
+{
+	// owns the dialogs and draws them retained mode: nothing is drawn again unless it changed. a change to a dialog
+	// dirties where it was drawn last and where it is now, overlapping dirty rects are merged, and a frame redraws
+	// exactly the dialogs touching a dirty rect in one submit, clipped to those rects by their Clear commands so a
+	// dialog drawn again can't paint over one above it that isn't. a frame without changes only checks an empty
+	// list. closed dialogs go back into a pool at the end of the next frame, their pointers are invalid from then on.
+	// Dialog is SystemDialog or a StaticSystemDialog, made from a Dialog::Backend
+	template <class Dialog>
+	class BasicDialogManager : public DialogListener
+	{
+	public:
+		struct Stats
+		{
+			uint64_t frames;
+			uint64_t idleFrames;		// nothing changed, nothing drawn
+			uint64_t dialogsRendered;
+			uint64_t dirtyRects;
+		};
+
+		explicit BasicDialogManager(typename Dialog::Backend& _backend) : backend(_backend) {}
+
+		BasicDialogManager(const BasicDialogManager&) = delete;
+		BasicDialogManager& operator=(const BasicDialogManager&) = delete;
+
+		// a dialog drawn from the next frame on, taken from the pool when it has one
+		Dialog* create()
+		{
+			uint32_t index;
+			if (!pool.empty())
+			{
+				index = pool.back();
+				pool.pop_back();
+			}
+			else
+			{
+				index = static_cast<uint32_t>(managed.size());
+				managed.push_back(Managed { std::unique_ptr<Dialog>(new Dialog(&backend)), DialogRect {}, false, false });
+				indices.emplace(managed.back().dialog.get(), index);
+				managed.back().dialog->setListener(this);
+			}
+
+			Managed& entry = managed[index];
+			entry.live = true;
+			entry.drawn = false;
+			entry.dialog->markDirty(); // drawn even if nothing gets set
+			++liveCount;
+			return entry.dialog.get();
+		}
+
+		// draws what changed since the last frame, returns the number of dialogs drawn
+		size_t render()
+		{
+			++stats.frames;
+			if (changed.empty())
+			{
+				++stats.idleFrames;
+				return 0;
+			}
+
+			// where the changed dialogs were and are
+			dirtyRects.clear();
+			for (uint32_t index : changed)
+			{
+				Managed& entry = managed[index];
+				if (entry.drawn)
+					addDirty(entry.drawnRect);
+				if (!entry.dialog->isClosed())
+					addDirty(entry.dialog->rect());
+			}
+
+			commands.reset();
+			for (const DialogRect& dirty : dirtyRects)
+				commands.push(RenderCommand::make(RenderCommand::Type::Clear, 0, 0, dirty.x, dirty.y, dirty.w, dirty.h));
+
+			size_t rendered = 0;
+			for (Managed& entry : managed)
+			{
+				if (!entry.live || entry.dialog->isClosed() || !touchesDirty(entry.dialog->rect()))
+					continue;
+				entry.dialog->record(commands);
+				entry.drawnRect = entry.dialog->rect();
+				entry.drawn = true;
+				++rendered;
+			}
+			commands.sort();
+			backend.submit(commands);
+
+			// closed ones are gone from the screen now
+			for (uint32_t index : changed)
+			{
+				Managed& entry = managed[index];
+				entry.dialog->markClean();
+				if (entry.live && entry.dialog->isClosed())
+				{
+					entry.dialog->reset();
+					entry.live = false;
+					entry.drawn = false;
+					pool.push_back(index);
+					--liveCount;
+				}
+			}
+			changed.clear();
+
+			stats.dialogsRendered += rendered;
+			stats.dirtyRects += dirtyRects.size();
+			return rendered;
+		}
+
+		size_t size() const { return liveCount; }
+		size_t pooled() const { return pool.size(); }
+		const Stats& getStats() const { return stats; }
+
+		// the merged dirty rects of the last frame that had any
+		const std::vector<DialogRect>& lastDirtyRects() const { return dirtyRects; }
+
+	private:
+		struct Managed
+		{
+			std::unique_ptr<Dialog> dialog;
+			DialogRect drawnRect;
+			bool drawn;		// drawnRect is on screen
+			bool live;		// false while in the pool
+		};
+
+		void dialogChanged(DialogState& dialog) override
+		{
+			auto found = indices.find(&dialog);
+			if (found != indices.end())
+				changed.push_back(found->second);
+		}
+
+		// merges rect with every dirty rect it overlaps, and the result again with those it overlaps in turn
+		void addDirty(DialogRect rect)
+		{
+			if (rect.empty())
+				return;
+			for (size_t i = 0; i < dirtyRects.size();)
+			{
+				if (dirtyRects[i].intersects(rect))
+				{
+					rect = rect.merged(dirtyRects[i]);
+					dirtyRects[i] = dirtyRects.back();
+					dirtyRects.pop_back();
+					i = 0;
+				}
+				else
+					++i;
+			}
+			dirtyRects.push_back(rect);
+		}
+
+		bool touchesDirty(const DialogRect& rect) const
+		{
+			for (const DialogRect& dirty : dirtyRects)
+				if (dirty.intersects(rect))
+					return true;
+			return false;
+		}
+
+		typename Dialog::Backend& backend;
+		std::vector<Managed> managed;
+		std::unordered_map<const DialogState*, uint32_t> indices;
+		std::vector<uint32_t> pool;
+		std::vector<uint32_t> changed;	// each dialog once, the dirty flag sees to it
+		std::vector<DialogRect> dirtyRects;
+		RenderCommandBuffer commands;
+		size_t liveCount = 0;
+		Stats stats {};
+	};
+
+	using DialogManager = BasicDialogManager<SystemDialog>;
+
+	// dialogCount dialogs in a grid over frames: idle frames, frames changing one dialog's text and frames opening
+	// and closing one, against drawing everything every frame
+	inline void benchmarkDialogManager(size_t dialogCount = 1000, size_t frames = 1000)
+	{
+		HeadlessDialogImpl backend;
+		DialogManager manager(backend);
+		std::vector<SystemDialog*> dialogs;
+		for (size_t i = 0; i < dialogCount; ++i)
+		{
+			SystemDialog* dialog = manager.create();
+			dialog->setXYWH(float(i % 40) * 48, float(i / 40) * 32, 44, 28);
+			dialog->setText("Connection lost");
+			dialogs.push_back(dialog);
+		}
+		manager.render();
+
+		auto microsecondsPerFrame = [frames](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / double(frames);
+		};
+
+		RenderCommandBuffer commands;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			renderBatched(dialogs, commands, backend);
+		double everything = microsecondsPerFrame(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			manager.render();
+		double idle = microsecondsPerFrame(start);
+
+		size_t rendered = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			dialogs[frame * 7 % dialogs.size()]->setText(frame % 2 ? "Press X to continue" : "Connection lost");
+			rendered += manager.render();
+		}
+		double oneText = microsecondsPerFrame(start);
+		size_t textRendered = rendered;
+
+		// a toast popping up over the grid and going away again, its object coming back out of the pool every time
+		rendered = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			SystemDialog* toast = manager.create();
+			toast->setXYWH(float(frame % 20) * 50, 100, 300, 60);
+			toast->setLayer(1);
+			toast->setText("Trophy unlocked");
+			rendered += manager.render();
+			toast->close();
+			rendered += manager.render();
+		}
+		double toasts = microsecondsPerFrame(start);
+
+		std::cout << dialogCount << " dialogs, " << frames << " frames" << std::endl;
+		std::cout << "everything every frame: " << everything << " us per frame, " << dialogCount << " dialogs drawn" << std::endl;
+		std::cout << "nothing changed       : " << idle << " us per frame" << std::endl;
+		std::cout << "one text changed      : " << oneText << " us per frame, " << double(textRendered) / double(frames) << " dialogs drawn" << std::endl;
+		std::cout << "toast opened + closed : " << toasts << " us per pair of frames, " << double(rendered) / double(frames) << " dialogs drawn, "
+			<< manager.pooled() << " pooled, " << manager.size() << " live" << std::endl;
+	}
+}
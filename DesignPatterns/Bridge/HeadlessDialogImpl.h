@@ -0,0 +1,122 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "BridgePattern.h"
+
+namespace bridge_pattern
+{
+	// a backend drawing nothing, for tests and benchmarks off the consoles. counts what it is asked to do and, when
+	// told to, keeps the commands of the last frame as they came in. final, so StaticSystemDialog can inline its calls
+	class HeadlessDialogImpl final : public SystemDialogImpl
+	{
+	public:
+		struct Stats
+		{
+			uint64_t calls;			// into the backend, render() and submit() alike
+			uint64_t commands;
+			uint64_t stateChanges;
+		};
+
+		// a command of the last submit, its text copied out of the buffer
+		struct Recorded
+		{
+			RenderCommand command;
+			std::string text;
+		};
+
+		explicit HeadlessDialogImpl(bool _keepCommands = false) : keepCommands(_keepCommands) {}
+
+		void render() override
+		{
+			++stats.calls;
+			++stats.commands;
+		}
+
+		void setAnimData(const AnimData& data) override {}
+
+		void submit(const RenderCommandBuffer& commands) override
+		{
+			++stats.calls;
+			recorded.clear();
+
+			bool first = true;
+			uint32_t state = 0;
+			commands.forEach([&](const RenderCommand& command)
+			{
+				if (first || command.state() != state)
+				{
+					++stats.stateChanges;
+					state = command.state();
+					first = false;
+				}
+				++stats.commands;
+
+				if (keepCommands)
+				{
+					Recorded entry { command, std::string() };
+					if (command.type == RenderCommand::Type::Text)
+						entry.text.assign(commands.textOf(command), command.textLength);
+					recorded.push_back(entry);
+				}
+			});
+		}
+
+		const Stats& getStats() const { return stats; }
+		void resetStats() { stats = Stats {}; }
+		const std::vector<Recorded>& lastFrame() const { return recorded; }
+
+	private:
+		bool keepCommands;
+		Stats stats {};
+		std::vector<Recorded> recorded;
+	};
+
+	// dialogCount dialogs and overlays a frame, over frames: a render() call into the backend per dialog against
+	// recording all of them and submitting once. a real backend pays for every call and state change it gets,
+	// the headless one only shows how many there are
+	inline void benchmarkDialogCommandBuffer(size_t dialogCount = 500, size_t frames = 1000)
+	{
+		HeadlessDialogImpl backend;
+		std::vector<SystemDialog*> dialogs;
+		for (size_t i = 0; i < dialogCount; ++i)
+		{
+			SystemDialog* dialog = i % 4 == 0 ? new SystemDialogWithAnim(&backend) : new SystemDialog(&backend);
+			dialog->open(static_cast<SystemDialog::Align>(i % 3));
+			dialog->setXYWH(float(i % 40) * 48, float(i / 40) * 32, 200, 80);
+			dialog->setText(i % 2 ? "Press X to continue" : "Connection lost");
+			dialog->setLayer(static_cast<uint8_t>(i % 4 == 0 ? 1 : 0));
+			dialogs.push_back(dialog);
+		}
+
+		auto microsecondsPerFrame = [frames](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / double(frames);
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			for (SystemDialog* dialog : dialogs)
+				dialog->render();
+		double immediate = microsecondsPerFrame(start);
+		HeadlessDialogImpl::Stats immediateStats = backend.getStats();
+
+		backend.resetStats();
+		RenderCommandBuffer commands;
+		start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			renderBatched(dialogs, commands, backend);
+		double batched = microsecondsPerFrame(start);
+		HeadlessDialogImpl::Stats batchedStats = backend.getStats();
+
+		std::cout << dialogCount << " dialogs, " << frames << " frames" << std::endl;
+		std::cout << "render() per dialog: " << immediate << " us per frame, " << immediateStats.calls / frames << " backend calls" << std::endl;
+		std::cout << "command buffer     : " << batched << " us per frame, " << batchedStats.calls / frames << " backend call, "
+			<< batchedStats.commands / frames << " commands in " << batchedStats.stateChanges / frames << " states" << std::endl;
+
+		for (SystemDialog* dialog : dialogs)
+			delete dialog;
+	}
+}
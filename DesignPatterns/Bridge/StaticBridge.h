@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "BridgePattern.h"
+#include "HeadlessDialogImpl.h"
+
+namespace bridge_pattern
+{
+	// the bridge fixed at compile time, for a binary that ships with a single backend. Impl is the backend class
+	// itself: declared final, the compiler knows every call's target and inlines it, and without virtual functions
+	// of its own the dialog is a plain value that can sit in an array. with Impl = SystemDialogImpl the very same
+	// dialog goes through the virtual bridge again, as tools and tests choosing a backend at runtime need. what it draws,
+	// record() and the dirty tracking are DialogState's, shared with SystemDialog, so BasicDialogManager takes either
+	template <class Impl>
+	class StaticSystemDialog : public DialogState
+	{
+	public:
+		using Backend = Impl;
+
+		explicit StaticSystemDialog(Impl* _impl) : impl(_impl) {}
+
+		// SystemDialogWithAnim's open
+		void openWithAnim()
+		{
+			open(Align::Center);
+			impl->setAnimData(SystemDialogImpl::AnimData());
+			animated = true;
+		}
+
+		// the animation came with openWithAnim, not with the kind of dialog, so a pooled one starts without it
+		void reset()
+		{
+			DialogState::reset();
+			animated = false;
+		}
+
+		void render() { impl->render(); }
+
+	private:
+		Impl* impl;
+	};
+
+	// the cost of a render() call per dialog for dialogCount dialogs: the dynamic bridge as SystemDialog has it (a virtual
+	// render() calling the virtual backend), a StaticSystemDialog still on the virtual backend, and one on the final backend
+	inline void benchmarkStaticBridge(size_t dialogCount = 100000, size_t frames = 100)
+	{
+		HeadlessDialogImpl backend;
+
+		std::vector<SystemDialog*> dynamicDialogs;
+		std::vector<StaticSystemDialog<SystemDialogImpl>> virtualDialogs;
+		std::vector<StaticSystemDialog<HeadlessDialogImpl>> staticDialogs;
+		for (size_t i = 0; i < dialogCount; ++i)
+		{
+			dynamicDialogs.push_back(new SystemDialog(&backend));
+			virtualDialogs.emplace_back(&backend);
+			staticDialogs.emplace_back(&backend);
+		}
+
+		auto nanosecondsPerDialog = [&](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / double(dialogCount * frames);
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			for (SystemDialog* dialog : dynamicDialogs)
+				dialog->render();
+		double dynamicTime = nanosecondsPerDialog(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			for (auto& dialog : virtualDialogs)
+				dialog.render();
+		double virtualTime = nanosecondsPerDialog(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			for (auto& dialog : staticDialogs)
+				dialog.render();
+		double staticTime = nanosecondsPerDialog(start);
+
+		std::cout << dialogCount << " dialogs, " << frames << " frames, " << backend.getStats().calls << " backend calls" << std::endl;
+		std::cout << "SystemDialog                        : " << dynamicTime << " ns per render" << std::endl;
+		std::cout << "StaticSystemDialog<SystemDialogImpl>: " << virtualTime << " ns per render" << std::endl;
+		std::cout << "StaticSystemDialog<final backend>   : " << staticTime << " ns per render" << std::endl;
+
+		for (SystemDialog* dialog : dynamicDialogs)
+			delete dialog;
+	}
+}
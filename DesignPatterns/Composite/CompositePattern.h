@@ -2,37 +2,173 @@
 #include <algorithm>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cfloat>
+#include <cstdint>
+#include "PartArena.h"
 
 namespace composite_pattern
 {
+	// concrete kind of a part, lets code working on whole trees switch instead of calling through the vtable
+	enum class PartType : uint8_t
+	{
+		Part,
+		Graphics,
+		Physics,
+		BodyParts,
+		Tyres,
+		GlassWindow,
+		Engine,
+		Instance,
+	};
+
+	// axis aligned box, empty until something is merged into it
+	struct Bounds
+	{
+		float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		bool empty() const { return min[0] > max[0]; }
+
+		void merge(const Bounds& other)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				min[i] = std::min(min[i], other.min[i]);
+				max[i] = std::max(max[i], other.max[i]);
+			}
+		}
+	};
+
+	// what a part and everything below it add up to
+	struct PartAggregate
+	{
+		Bounds bounds;
+		float mass = 0;
+		uint32_t drawCount = 0; // parts with something to draw, the length of the subtree's draw list
+
+		void merge(const PartAggregate& other)
+		{
+			bounds.merge(other.bounds);
+			mass += other.mass;
+			drawCount += other.drawCount;
+		}
+	};
+
 	class CarSparePart
 	{
 	public:
 		using ChildPartItr = std::vector<CarSparePart*>::iterator;
 		ChildPartItr Invalid;
 
+		virtual ~CarSparePart() {}
+
+		virtual PartType type() const { return PartType::Part; }
 		virtual void draw() {}
+		virtual size_t childCount() const { return 0; }
 		virtual ChildPartItr getChildIterator(unsigned int i = 0) { return Invalid; }
 		virtual CarSparePart* getParent() { return parentPart; }
-		virtual void setParent(CarSparePart* _ptr) { parentPart = _ptr; }
+		virtual void setParent(CarSparePart* _ptr) { reparent(_ptr); }
 		virtual void addChild(CarSparePart*) {}
 		virtual void removeChild(CarSparePart*) {}
 
+		// the part's own share of aggregate(), without its children
+		virtual PartAggregate localAggregate() const { return PartAggregate(); }
+
+		// the aggregate of the whole subtree. cached, only parts changed since the last call and their ancestors get
+		// recomputed, so asking the root of an untouched assembly costs nothing. not thread safe
+		const PartAggregate& aggregate()
+		{
+			if (aggregateDirty)
+			{
+				cachedAggregate = localAggregate();
+				for (size_t i = 0; i < childCount(); ++i)
+					cachedAggregate.merge((*getChildIterator(static_cast<unsigned>(i)))->aggregate());
+				aggregateDirty = false;
+			}
+			return cachedAggregate;
+		}
+
+		// to be called whenever something localAggregate depends on changes.
+		// the ancestors of a dirty part are all dirty, so the walk up stops at the first dirty one
+		void invalidate()
+		{
+			for (CarSparePart* part = this; part && !part->aggregateDirty; part = part->getParent())
+				part->aggregateDirty = true;
+		}
+
+		bool aggregateValid() const { return !aggregateDirty; }
+
+	protected:
+		// both the parent losing the part and the one gaining it have a different aggregate now
+		void reparent(CarSparePart* _ptr)
+		{
+			if (parentPart)
+				parentPart->invalidate();
+			parentPart = _ptr;
+			if (parentPart)
+				parentPart->invalidate();
+		}
+
 	private:
+		friend class BodyParts;
+
 		CarSparePart* parentPart = nullptr;
+		size_t siblingIndex = 0; // position in the parent's children, for constant time removal
+		PartAggregate cachedAggregate;
+		bool aggregateDirty = true;
 	};
 
 	// leaves
 	class Graphics : public CarSparePart
 	{
 	public:
+		PartType type() const override { return PartType::Graphics; }
 		void draw() override {}
+
+		void setBounds(const Bounds& _bounds)
+		{
+			bounds = _bounds;
+			invalidate();
+		}
+		const Bounds& getBounds() const { return bounds; }
+
+		PartAggregate localAggregate() const override
+		{
+			PartAggregate local;
+			local.bounds = bounds;
+			local.drawCount = 1;
+			return local;
+		}
+
+	private:
+		Bounds bounds;
 	};
 
 	class Physics : public CarSparePart
 	{
 	public:
+		PartType type() const override { return PartType::Physics; }
 		void draw() override {}
+
+		void setMass(float _mass)
+		{
+			mass = _mass;
+			invalidate();
+		}
+		float getMass() const { return mass; }
+
+		PartAggregate localAggregate() const override
+		{
+			PartAggregate local;
+			local.mass = mass;
+			return local;
+		}
+
+	private:
+		float mass = 0;
 	};
 
 	// composite
@@ -42,11 +178,15 @@ namespace composite_pattern
 		BodyParts()
 		{}
 
+		PartType type() const override { return PartType::BodyParts; }
+
 		void draw() override
 		{
 			for_each(childParts.begin(), childParts.end(), std::bind(&CarSparePart::draw, std::placeholders::_1));
 		}
 
+		size_t childCount() const override { return childParts.size(); }
+
 		virtual ChildPartItr getChildIterator(unsigned int i) override
 		{
 			return childParts.begin() + i;
@@ -54,63 +194,83 @@ namespace composite_pattern
 
 		virtual void addChild(CarSparePart* newPart)
 		{
+			newPart->siblingIndex = childParts.size();
 			childParts.push_back(newPart);
 			newPart->setParent(this);
 		}
+
+		// constant time: the last child takes the place of the removed one, so the order of the children changes
 		virtual void removeChild(CarSparePart* existingPart)
 		{
+			size_t index = existingPart->siblingIndex;
+			if (index >= childParts.size() || childParts[index] != existingPart)
+				return;
+
+			childParts[index] = childParts.back();
+			childParts[index]->siblingIndex = index;
+			childParts.pop_back();
 			existingPart->setParent(nullptr);
-			std::remove(childParts.begin(), childParts.end(), existingPart);
 		}
 
 	private:
 		std::vector<CarSparePart*> childParts { };
 	};
 
-	class Tyres : public CarSparePart
+	class Tyres : public BodyParts
 	{
+	public:
+		PartType type() const override { return PartType::Tyres; }
+
 		/*
 			implementation details
 		*/
 	};
 
-	class GlassWindow : public CarSparePart
+	class GlassWindow : public BodyParts
 	{
+	public:
+		PartType type() const override { return PartType::GlassWindow; }
+
 		/*
 			implementation details
 		*/
 	};
 
-	class Engine : public CarSparePart
+	class Engine : public BodyParts
 	{
+	public:
+		PartType type() const override { return PartType::Engine; }
+
 		/*
 			implementation details
 		*/
 	};
 
-	void MakeCar()
+	inline void MakeCar()
 	{
+		PartArena arena; // owns the leaves, they go with it in one go
+
 		Tyres frontLeft, frontRight, backLeft, backRight;
-		frontLeft.addChild(new Graphics());
-		frontRight.addChild(new Graphics());
-		backLeft.addChild(new Graphics());
-		backRight.addChild(new Graphics());
+		frontLeft.addChild(arena.create<Graphics>());
+		frontRight.addChild(arena.create<Graphics>());
+		backLeft.addChild(arena.create<Graphics>());
+		backRight.addChild(arena.create<Graphics>());
 		
-		frontLeft.addChild(new Physics());
-		frontRight.addChild(new Physics());
-		backLeft.addChild(new Physics());
-		backRight.addChild(new Physics());
+		frontLeft.addChild(arena.create<Physics>());
+		frontRight.addChild(arena.create<Physics>());
+		backLeft.addChild(arena.create<Physics>());
+		backRight.addChild(arena.create<Physics>());
 
 		GlassWindow front, sidefrontLeft, sidefrontRight, sideBackLeft, sideBackRight, back;
-		front.addChild(new Graphics());
-		sidefrontLeft.addChild(new Graphics());
-		sidefrontRight.addChild(new Graphics());
-		sideBackLeft.addChild(new Graphics());
-		sideBackRight.addChild(new Graphics());
-		back.addChild(new Graphics());
+		front.addChild(arena.create<Graphics>());
+		sidefrontLeft.addChild(arena.create<Graphics>());
+		sidefrontRight.addChild(arena.create<Graphics>());
+		sideBackLeft.addChild(arena.create<Graphics>());
+		sideBackRight.addChild(arena.create<Graphics>());
+		back.addChild(arena.create<Graphics>());
 
 		BodyParts body;
-		body.addChild(new Graphics());
+		body.addChild(arena.create<Graphics>());
 		body.addChild(&frontLeft);
 		body.addChild(&frontRight);
 		body.addChild(&backLeft);
@@ -122,7 +282,152 @@ namespace composite_pattern
 		body.addChild(&sideBackRight);
 		body.addChild(&back);
 
-		CarSparePart car;
+		BodyParts car;
 		car.addChild(&body);
 	}
+
+	inline CarSparePart* createPart(PartType type)
+	{
+		switch (type)
+		{
+		case PartType::Graphics: return new Graphics();
+		case PartType::Physics: return new Physics();
+		case PartType::BodyParts: return new BodyParts();
+		case PartType::Tyres: return new Tyres();
+		case PartType::GlassWindow: return new GlassWindow();
+		case PartType::Engine: return new Engine();
+		default: return new CarSparePart();
+		}
+	}
+
+	inline CarSparePart* createPart(PartType type, PartArena& arena)
+	{
+		switch (type)
+		{
+		case PartType::Graphics: return arena.create<Graphics>();
+		case PartType::Physics: return arena.create<Physics>();
+		case PartType::BodyParts: return arena.create<BodyParts>();
+		case PartType::Tyres: return arena.create<Tyres>();
+		case PartType::GlassWindow: return arena.create<GlassWindow>();
+		case PartType::Engine: return arena.create<Engine>();
+		default: return arena.create<CarSparePart>();
+		}
+	}
+
+	// builds an assembly of about nodeCount parts: bodies of fanOut parts each, Graphics and Physics leaves at the bottom.
+	// every part comes from create(PartType)
+	template <class Create>
+	CarSparePart* buildAssemblyWith(size_t nodeCount, size_t fanOut, Create&& create)
+	{
+		CarSparePart* root = create(PartType::BodyParts);
+
+		// breadth first so the tree comes out balanced
+		std::vector<CarSparePart*> level { root };
+		size_t built = 1;
+		while (built < nodeCount)
+		{
+			std::vector<CarSparePart*> nextLevel;
+			bool last = built + level.size() * fanOut >= nodeCount;
+			for (CarSparePart* parent : level)
+			{
+				for (size_t i = 0; i < fanOut && built < nodeCount; ++i, ++built)
+				{
+					static const PartType composites[] = { PartType::Tyres, PartType::GlassWindow, PartType::Engine };
+					CarSparePart* child = create(last ? (i % 2 ? PartType::Physics : PartType::Graphics) : composites[i % 3]);
+					parent->addChild(child);
+					nextLevel.push_back(child);
+				}
+			}
+			if (last)
+				break;
+			level.swap(nextLevel);
+		}
+		return root;
+	}
+
+	// buildAssemblyWith, the parts owned by storage
+	inline CarSparePart* buildAssembly(size_t nodeCount, size_t fanOut, std::vector<std::unique_ptr<CarSparePart>>& storage)
+	{
+		storage.reserve(storage.size() + nodeCount);
+		return buildAssemblyWith(nodeCount, fanOut, [&storage](PartType type)
+		{
+			storage.emplace_back(createPart(type));
+			return storage.back().get();
+		});
+	}
+
+	// root->aggregate() from scratch against after touching a few leaves, on an assembly of nodeCount parts
+	inline void benchmarkPartAggregates(size_t nodeCount = 1000000, size_t touched = 100)
+	{
+		std::vector<std::unique_ptr<CarSparePart>> storage;
+		CarSparePart* root = buildAssembly(nodeCount, 8, storage);
+
+		std::vector<Physics*> leaves;
+		for (auto& part : storage)
+			if (part->type() == PartType::Physics)
+				leaves.push_back(static_cast<Physics*>(part.get()));
+
+		auto milliseconds = [](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		float mass = root->aggregate().mass;
+		double full = milliseconds(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < touched && !leaves.empty(); ++i)
+			leaves[i * 7919 % leaves.size()]->setMass(float(i));
+		mass = root->aggregate().mass;
+		double incremental = milliseconds(start);
+
+		start = std::chrono::steady_clock::now();
+		bool same = root->aggregate().mass == mass;
+		double unchanged = milliseconds(start);
+
+		std::cout << storage.size() << " parts (total mass " << mass << (same ? "" : ", inconsistent") << ")" << std::endl;
+		std::cout << "full evaluation      : " << full << " ms" << std::endl;
+		std::cout << touched << " leaves changed    : " << incremental << " ms" << std::endl;
+		std::cout << "nothing changed      : " << unchanged << " ms" << std::endl;
+	}
+
+	// building and tearing down an assembly of nodeCount parts, one new and delete per part against a PartArena
+	inline void benchmarkPartArena(size_t nodeCount = 1000000, int rounds = 5)
+	{
+		auto milliseconds = [](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		double build = 0, teardown = 0;
+		for (int round = 0; round < rounds; ++round)
+		{
+			std::vector<std::unique_ptr<CarSparePart>> storage;
+			auto start = std::chrono::steady_clock::now();
+			buildAssembly(nodeCount, 8, storage);
+			build += milliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			storage.clear();
+			teardown += milliseconds(start);
+		}
+		std::cout << "new/delete : build " << build / rounds << " ms, teardown " << teardown / rounds << " ms" << std::endl;
+
+		build = teardown = 0;
+		PartArena arena;
+		size_t blocks = 0;
+		for (int round = 0; round < rounds; ++round)
+		{
+			auto start = std::chrono::steady_clock::now();
+			buildAssemblyWith(nodeCount, 8, [&arena](PartType type) { return createPart(type, arena); });
+			build += milliseconds(start);
+			blocks = arena.blockCount();
+
+			start = std::chrono::steady_clock::now();
+			arena.clear();
+			teardown += milliseconds(start);
+		}
+		std::cout << "arena      : build " << build / rounds << " ms, teardown " << teardown / rounds << " ms, " << blocks << " blocks" << std::endl;
+	}
 }
\ No newline at end of file
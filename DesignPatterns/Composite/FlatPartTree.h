@@ -0,0 +1,156 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "CompositePattern.h"
+
+namespace composite_pattern
+{
+	// read only snapshot of a part tree laid out depth first in flat arrays.
+	// node i's subtree is [i, i + subtreeSize[i]), its first child i + 1 and its next sibling i + subtreeSize[i],
+	// so a whole traversal is one linear pass without a pointer to follow or a virtual call to make.
+	// the tree stays the thing to edit, bake again after changing it
+	class FlatPartTree
+	{
+	public:
+		static const uint32_t NoParent = UINT32_MAX;
+
+		FlatPartTree() {}
+		explicit FlatPartTree(CarSparePart* root) { bake(root); }
+
+		void bake(CarSparePart* root)
+		{
+			types.clear();
+			parents.clear();
+			subtreeSizes.clear();
+			sources.clear();
+			if (!root)
+				return;
+
+			// explicit stack, deep assemblies would blow the call stack
+			struct Pending
+			{
+				CarSparePart* part;
+				uint32_t parent;
+			};
+			std::vector<Pending> stack { Pending { root, NoParent } };
+			std::vector<uint32_t> open; // nodes whose subtree is still being emitted
+
+			while (!stack.empty())
+			{
+				Pending next = stack.back();
+				stack.pop_back();
+
+				// close the subtrees next isn't part of
+				while (!open.empty() && open.back() != next.parent)
+				{
+					subtreeSizes[open.back()] = static_cast<uint32_t>(types.size()) - open.back();
+					open.pop_back();
+				}
+
+				uint32_t index = static_cast<uint32_t>(types.size());
+				types.push_back(next.part->type());
+				parents.push_back(next.parent);
+				subtreeSizes.push_back(1);
+				sources.push_back(next.part);
+				open.push_back(index);
+
+				// reversed so the first child comes off the stack first
+				for (size_t i = next.part->childCount(); i > 0; --i)
+					stack.push_back(Pending { *next.part->getChildIterator(static_cast<unsigned>(i - 1)), index });
+			}
+			while (!open.empty())
+			{
+				subtreeSizes[open.back()] = static_cast<uint32_t>(types.size()) - open.back();
+				open.pop_back();
+			}
+		}
+
+		size_t size() const { return types.size(); }
+		bool empty() const { return types.empty(); }
+
+		PartType type(uint32_t node) const { return types[node]; }
+		uint32_t parent(uint32_t node) const { return parents[node]; }
+		uint32_t subtreeSize(uint32_t node) const { return subtreeSizes[node]; }
+		uint32_t nextSibling(uint32_t node) const { return node + subtreeSizes[node]; }
+		uint32_t depth(uint32_t node) const
+		{
+			uint32_t result = 0;
+			for (uint32_t p = parents[node]; p != NoParent; p = parents[p])
+				++result;
+			return result;
+		}
+
+		// the part a node was baked from, to get back to the editable tree
+		CarSparePart* source(uint32_t node) const { return sources[node]; }
+
+		// visitor(index, type) for every node of the subtree of root, parents before their children
+		template <class Visitor>
+		void forEach(Visitor&& visitor, uint32_t root = 0) const
+		{
+			if (root >= types.size())
+				return;
+			for (uint32_t i = root, end = root + subtreeSizes[root]; i < end; ++i)
+				visitor(i, types[i]);
+		}
+
+		// like forEach, but a visitor returning false skips the children of that node
+		template <class Visitor>
+		void forEachPruned(Visitor&& visitor, uint32_t root = 0) const
+		{
+			if (root >= types.size())
+				return;
+			for (uint32_t i = root, end = root + subtreeSizes[root]; i < end;)
+				i += visitor(i, types[i]) ? 1 : subtreeSizes[i];
+		}
+
+		// visitor(index, type) for the direct children of node
+		template <class Visitor>
+		void forEachChild(uint32_t node, Visitor&& visitor) const
+		{
+			for (uint32_t i = node + 1, end = node + subtreeSizes[node]; i < end; i += subtreeSizes[i])
+				visitor(i, types[i]);
+		}
+
+	private:
+		std::vector<PartType> types;
+		std::vector<uint32_t> parents;
+		std::vector<uint32_t> subtreeSizes;
+		std::vector<CarSparePart*> sources;
+	};
+
+	// recursive draw() through the tree against a linear pass over the baked arrays, on nodeCount parts
+	inline void benchmarkFlatPartTree(size_t nodeCount = 1000000, size_t fanOut = 8, int passes = 10)
+	{
+		std::vector<std::unique_ptr<CarSparePart>> storage;
+		CarSparePart* root = buildAssembly(nodeCount, fanOut, storage);
+
+		auto seconds = [](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		FlatPartTree flat(root);
+		double bakeTime = seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < passes; ++pass)
+			root->draw();
+		double treeTime = seconds(start) / passes;
+
+		// counting the leaves stands in for the work draw would do per node
+		size_t leaves = 0;
+		start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < passes; ++pass)
+			flat.forEach([&](uint32_t, PartType type) { leaves += type == PartType::Graphics || type == PartType::Physics; });
+		double flatTime = seconds(start) / passes;
+
+		double nanoseconds = 1e9 / double(flat.size());
+		std::cout << flat.size() << " parts, " << leaves / passes << " leaves, baked in " << bakeTime * 1000 << " ms" << std::endl;
+		std::cout << "tree draw : " << treeTime * nanoseconds << " ns/part" << std::endl;
+		std::cout << "flat scan : " << flatTime * nanoseconds << " ns/part" << std::endl;
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace composite_pattern
+{
+	// bump allocator for the parts of an assembly: objects are carved out of a few big blocks one after the other,
+	// and clear() gets rid of all of them at once. each object is preceded by a small header chaining it to the one
+	// created before, which is how clear() finds the destructors to run. the blocks are freed as a whole, never an object
+	class PartArena
+	{
+	public:
+		static const size_t DefaultBlockSize = 256 * 1024;
+
+		explicit PartArena(size_t _blockSize = DefaultBlockSize)
+			: blockSize(_blockSize)
+		{}
+
+		~PartArena() { clear(); }
+
+		PartArena(const PartArena&) = delete;
+		PartArena& operator=(const PartArena&) = delete;
+
+		template <class T, class... Args>
+		T* create(Args&&... args)
+		{
+			static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types aren't supported");
+
+			char* memory = allocate(sizeof(T));
+			T* object = new (memory) T(std::forward<Args>(args)...);
+
+			// the header only goes live once the constructor succeeded
+			Header* header = reinterpret_cast<Header*>(memory - HeaderSize);
+			header->previous = last;
+			header->destroy = &destroy<T>;
+			last = header;
+			++objects;
+			return object;
+		}
+
+		// destroys everything created, newest first, and keeps the first block for whatever comes next
+		void clear()
+		{
+			for (Header* header = last; header; header = header->previous)
+				header->destroy(reinterpret_cast<char*>(header) + HeaderSize);
+			last = nullptr;
+			objects = 0;
+			used = 0;
+
+			if (blocks.size() > 1)
+				blocks.resize(1);
+			if (!blocks.empty())
+			{
+				cursor = blocks.front().get();
+				end = cursor + blockSize;
+			}
+		}
+
+		size_t size() const { return objects; }
+		size_t blockCount() const { return blocks.size(); }
+		size_t bytesUsed() const { return used; } // headers included
+
+	private:
+		struct Header
+		{
+			Header* previous;
+			void (*destroy)(void*);
+		};
+
+		static const size_t Alignment = alignof(std::max_align_t);
+		static const size_t HeaderSize = (sizeof(Header) + Alignment - 1) / Alignment * Alignment;
+
+		template <class T>
+		static void destroy(void* object) { static_cast<T*>(object)->~T(); }
+
+		static size_t alignUp(size_t size) { return (size + Alignment - 1) / Alignment * Alignment; }
+
+		// room for a header and size bytes, returns where the object goes
+		char* allocate(size_t size)
+		{
+			size_t needed = HeaderSize + alignUp(size);
+			if (static_cast<size_t>(end - cursor) < needed)
+			{
+				// objects bigger than a block get a block of their own. new[] hands out memory aligned for anything
+				size_t bytes = std::max(blockSize, needed);
+				blocks.emplace_back(new char[bytes]);
+				cursor = blocks.back().get();
+				end = cursor + bytes;
+			}
+
+			char* memory = cursor + HeaderSize;
+			cursor += needed;
+			used += needed;
+			return memory;
+		}
+
+		size_t blockSize;
+		std::vector<std::unique_ptr<char[]>> blocks;
+		char* cursor = nullptr;
+		char* end = nullptr;
+		Header* last = nullptr;
+		size_t objects = 0;
+		size_t used = 0;
+	};
+}
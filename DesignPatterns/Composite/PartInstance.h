@@ -0,0 +1,262 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "CompositePattern.h"
+#include "PartArena.h"
+
+namespace composite_pattern
+{
+	// what sets one instance of a shared subtree apart from the others
+	struct PartOverrides
+	{
+		float offset[3] = { 0, 0, 0 };	// moves the bounds of the whole subtree
+		float massScale = 1;
+		bool hidden = false;			// nothing of the subtree gets drawn
+	};
+
+	class PartInstance;
+
+	// a subtree shared by any number of PartInstances. its parts have no parent, the instances only point at the root.
+	// edit the subtree as usual and call edited() afterwards, the aggregates of the instances depend on it.
+	// must outlive its instances
+	class PartPrototype
+	{
+	public:
+		explicit PartPrototype(CarSparePart* _root) : m_root(_root) {}
+
+		PartPrototype(const PartPrototype&) = delete;
+		PartPrototype& operator=(const PartPrototype&) = delete;
+
+		CarSparePart* root() const { return m_root; }
+		size_t instanceCount() const { return instances.size(); }
+
+		inline void edited();
+
+	private:
+		friend class PartInstance;
+
+		CarSparePart* m_root;
+		std::vector<PartInstance*> instances;
+	};
+
+	// stands for a whole PartPrototype in a tree without copying it. to the tree api it is a leaf,
+	// forEachResolved walks through it into the shared subtree
+	class PartInstance : public CarSparePart
+	{
+	public:
+		explicit PartInstance(PartPrototype& _prototype, const PartOverrides& _overrides = PartOverrides())
+			: prototype(_prototype)
+			, overrides(_overrides)
+			, registryIndex(_prototype.instances.size())
+		{
+			prototype.instances.push_back(this);
+		}
+
+		~PartInstance() override
+		{
+			// swap remove, like BodyParts does with its children
+			std::vector<PartInstance*>& instances = prototype.instances;
+			instances[registryIndex] = instances.back();
+			instances[registryIndex]->registryIndex = registryIndex;
+			instances.pop_back();
+		}
+
+		PartInstance(const PartInstance&) = delete;
+		PartInstance& operator=(const PartInstance&) = delete;
+
+		PartType type() const override { return PartType::Instance; }
+
+		void draw() override
+		{
+			if (!overrides.hidden)
+				prototype.root()->draw();
+		}
+
+		PartPrototype& getPrototype() const { return prototype; }
+		const PartOverrides& getOverrides() const { return overrides; }
+
+		void setOverrides(const PartOverrides& _overrides)
+		{
+			overrides = _overrides;
+			invalidate();
+		}
+
+		// the prototype's aggregate as seen through the overrides, the prototype computes its own only once for all
+		PartAggregate localAggregate() const override
+		{
+			PartAggregate result = prototype.root()->aggregate();
+			if (!result.bounds.empty())
+			{
+				for (int i = 0; i < 3; ++i)
+				{
+					result.bounds.min[i] += overrides.offset[i];
+					result.bounds.max[i] += overrides.offset[i];
+				}
+			}
+			result.mass *= overrides.massScale;
+			if (overrides.hidden)
+				result.drawCount = 0;
+			return result;
+		}
+
+	private:
+		PartPrototype& prototype;
+		PartOverrides overrides;
+		size_t registryIndex;
+	};
+
+	inline void PartPrototype::edited()
+	{
+		for (PartInstance* instance : instances)
+			instance->invalidate();
+	}
+
+	// the overrides in effect at a part, those of every instance on the way down combined
+	struct ResolvedPart
+	{
+		float offset[3];
+		float massScale;
+		bool hidden;
+		const PartInstance* instance; // innermost instance the part is seen through, nullptr outside of any
+
+		void apply(const PartOverrides& overrides)
+		{
+			for (int i = 0; i < 3; ++i)
+				offset[i] += overrides.offset[i];
+			massScale *= overrides.massScale;
+			hidden = hidden || overrides.hidden;
+		}
+	};
+
+	// visitor(part, resolved) for every part below and including root, descending into the prototypes of instances.
+	// a shared part is visited once per instance, each time with the state of that instance. parents come first
+	template <class Visitor>
+	void forEachResolved(CarSparePart* root, Visitor&& visitor)
+	{
+		struct Pending
+		{
+			CarSparePart* part;
+			ResolvedPart state;
+		};
+		std::vector<Pending> stack { Pending { root, ResolvedPart { { 0, 0, 0 }, 1, false, nullptr } } };
+
+		while (!stack.empty())
+		{
+			Pending next = stack.back();
+			stack.pop_back();
+			visitor(next.part, static_cast<const ResolvedPart&>(next.state));
+
+			if (next.part->type() == PartType::Instance)
+			{
+				PartInstance* instance = static_cast<PartInstance*>(next.part);
+				next.state.apply(instance->getOverrides());
+				next.state.instance = instance;
+				stack.push_back(Pending { instance->getPrototype().root(), next.state });
+				continue;
+			}
+
+			for (size_t i = next.part->childCount(); i > 0; --i)
+				stack.push_back(Pending { *next.part->getChildIterator(static_cast<unsigned>(i - 1)), next.state });
+		}
+	}
+
+	// MakeCar's car out of arena: a body with its Graphics, four Tyres and six GlassWindows, every one with its own
+	// Graphics and the tyres with Physics
+	inline CarSparePart* buildCar(PartArena& arena)
+	{
+		BodyParts* body = arena.create<BodyParts>();
+		body->addChild(arena.create<Graphics>());
+
+		for (int i = 0; i < 4; ++i)
+		{
+			Tyres* tyre = arena.create<Tyres>();
+			tyre->addChild(arena.create<Graphics>());
+			Physics* physics = arena.create<Physics>();
+			physics->setMass(20);
+			tyre->addChild(physics);
+			body->addChild(tyre);
+		}
+		for (int i = 0; i < 6; ++i)
+		{
+			GlassWindow* window = arena.create<GlassWindow>();
+			window->addChild(arena.create<Graphics>());
+			body->addChild(window);
+		}
+		return body;
+	}
+
+	// a fleet of cars each built in full against one car shared by as many instances: memory, a resolved walk
+	// through every part and the fleet's aggregate
+	inline void benchmarkPartInstancing(size_t cars = 10000)
+	{
+		auto milliseconds = [](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		// arena bytes plus what the composites allocate for their children
+		auto footprint = [](CarSparePart* root, const PartArena& arena)
+		{
+			size_t bytes = arena.bytesUsed();
+			forEachResolved(root, [&](CarSparePart* part, const ResolvedPart& resolved)
+			{
+				if (!resolved.instance)
+					bytes += part->childCount() * sizeof(CarSparePart*);
+			});
+			return bytes;
+		};
+
+		auto measure = [&](const char* label, CarSparePart* fleet, size_t bytes)
+		{
+			size_t visited = 0, drawn = 0;
+			float mass = 0;
+			auto start = std::chrono::steady_clock::now();
+			forEachResolved(fleet, [&](CarSparePart* part, const ResolvedPart& resolved)
+			{
+				++visited;
+				if (part->type() == PartType::Graphics && !resolved.hidden)
+					++drawn;
+				else if (part->type() == PartType::Physics)
+					mass += static_cast<Physics*>(part)->getMass() * resolved.massScale;
+			});
+			double walk = milliseconds(start);
+
+			start = std::chrono::steady_clock::now();
+			const PartAggregate& aggregate = fleet->aggregate();
+			double aggregateTime = milliseconds(start);
+
+			std::cout << label << bytes / 1024 << " KB, walk of " << visited << " parts " << walk << " ms, aggregate "
+				<< aggregateTime << " ms (" << drawn << "/" << aggregate.drawCount << " drawn, mass " << mass << "/" << aggregate.mass << ")" << std::endl;
+		};
+
+		{
+			PartArena arena;
+			BodyParts* fleet = arena.create<BodyParts>();
+			for (size_t i = 0; i < cars; ++i)
+				fleet->addChild(buildCar(arena));
+			measure("copies    : ", fleet, footprint(fleet, arena));
+		}
+
+		{
+			// declared in this order the instances go before the prototype they unregister from
+			PartArena prototypeArena;
+			PartPrototype car(buildCar(prototypeArena));
+			PartArena arena;
+			BodyParts* fleet = arena.create<BodyParts>();
+			for (size_t i = 0; i < cars; ++i)
+			{
+				PartOverrides overrides;
+				overrides.offset[0] = float(i % 100) * 5;
+				overrides.offset[2] = float(i / 100) * 5;
+				fleet->addChild(arena.create<PartInstance>(car, overrides));
+			}
+
+			size_t bytes = footprint(fleet, arena) + prototypeArena.bytesUsed();
+			forEachResolved(car.root(), [&](CarSparePart* part, const ResolvedPart&) { bytes += part->childCount() * sizeof(CarSparePart*); });
+			measure("instances : ", fleet, bytes);
+		}
+	}
+}
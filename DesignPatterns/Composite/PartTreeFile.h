@@ -0,0 +1,431 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include "CompositePattern.h"
+#include "FlatPartTree.h"
+#include "PartInstance.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace composite_pattern
+{
+	// binary image of a part tree, in the machine's own byte order:
+	//   PartFileHeader
+	//   PartRecord[nodeCount]	depth first, same layout as FlatPartTree
+	//   payload bytes			leaf data, each payload 8 byte aligned
+	// records point at their payload by offset from the start of the payload section. loading maps the file copy on
+	// write and turns those offsets into pointers where they are, nothing gets parsed or allocated per part.
+	// the saved tree starts at record 0. the prototypes its instances share follow it, each once and as a tree of its
+	// own (no parent), and an instance's payload names the record its prototype starts at
+	struct PartFileHeader
+	{
+		static const uint32_t Magic = 0x31505343; // "CSP1"
+		static const uint32_t Version = 2;
+
+		uint32_t magic;
+		uint32_t version;
+		uint32_t nodeCount;
+		uint32_t reserved;
+		uint64_t payloadBytes;
+	};
+
+	struct PartRecord
+	{
+		PartType type;
+		uint8_t reserved[3];
+		uint32_t parent;
+		uint32_t subtreeSize;
+		uint32_t payloadSize;
+		union
+		{
+			uint64_t payloadOffset;		// in the file
+			const char* payload;		// once loaded
+		};
+	};
+
+	// the payload of an Instance
+	struct PartInstanceRecord
+	{
+		uint32_t prototype;			// record the prototype's tree starts at, always after the instance
+		float offset[3];			// PartOverrides
+		float massScale;
+		uint8_t hidden;
+		uint8_t reserved[3];
+	};
+
+	static_assert(sizeof(PartFileHeader) == 24, "the file layout mustn't depend on the compiler");
+	static_assert(sizeof(PartRecord) == 24, "the file layout mustn't depend on the compiler");
+	static_assert(sizeof(PartInstanceRecord) == 24, "the file layout mustn't depend on the compiler");
+
+	// Graphics store their bounds, Physics their mass, Instances their prototype and overrides, the other parts nothing
+	inline bool savePartTree(CarSparePart* root, const std::string& path)
+	{
+		std::vector<PartRecord> records;
+		std::vector<char> payloads;
+
+		// the trees to write, the saved one and then every prototype in the order its first instance was met.
+		// an instance only learns where its prototype starts once that tree is written
+		std::vector<CarSparePart*> trees { root };
+		std::vector<const PartPrototype*> prototypes { nullptr };
+		std::vector<uint32_t> treeStarts;
+		struct PendingInstance
+		{
+			size_t payload;		// of the PartInstanceRecord
+			size_t tree;
+		};
+		std::vector<PendingInstance> instances;
+
+		auto appendPayload = [&payloads](const void* payload, size_t size)
+		{
+			size_t offset = payloads.size();
+			payloads.insert(payloads.end(), static_cast<const char*>(payload), static_cast<const char*>(payload) + size);
+			payloads.resize((payloads.size() + 7) / 8 * 8);
+			return offset;
+		};
+
+		for (size_t tree = 0; tree < trees.size(); ++tree)
+		{
+			FlatPartTree flat(trees[tree]);
+			uint32_t start = static_cast<uint32_t>(records.size());
+			treeStarts.push_back(start);
+			records.resize(start + flat.size());
+
+			for (uint32_t i = 0; i < flat.size(); ++i)
+			{
+				PartRecord& record = records[start + i];
+				memset(&record, 0, sizeof(record));
+				record.type = flat.type(i);
+				record.parent = flat.parent(i) == FlatPartTree::NoParent ? FlatPartTree::NoParent : start + flat.parent(i);
+				record.subtreeSize = flat.subtreeSize(i);
+
+				if (record.type == PartType::Graphics)
+				{
+					record.payloadSize = sizeof(Bounds);
+					record.payloadOffset = appendPayload(&static_cast<Graphics*>(flat.source(i))->getBounds(), sizeof(Bounds));
+				}
+				else if (record.type == PartType::Physics)
+				{
+					float mass = static_cast<Physics*>(flat.source(i))->getMass();
+					record.payloadSize = sizeof(mass);
+					record.payloadOffset = appendPayload(&mass, sizeof(mass));
+				}
+				else if (record.type == PartType::Instance)
+				{
+					const PartInstance* instance = static_cast<PartInstance*>(flat.source(i));
+					const PartPrototype* prototype = &instance->getPrototype();
+					size_t found = std::find(prototypes.begin(), prototypes.end(), prototype) - prototypes.begin();
+					if (found == prototypes.size())
+					{
+						prototypes.push_back(prototype);
+						trees.push_back(prototype->root());
+					}
+
+					const PartOverrides& overrides = instance->getOverrides();
+					PartInstanceRecord payload {};
+					memcpy(payload.offset, overrides.offset, sizeof(payload.offset));
+					payload.massScale = overrides.massScale;
+					payload.hidden = overrides.hidden;
+
+					record.payloadSize = sizeof(payload);
+					record.payloadOffset = appendPayload(&payload, sizeof(payload));
+					instances.push_back(PendingInstance { record.payloadOffset, found });
+				}
+			}
+		}
+
+		for (const PendingInstance& instance : instances)
+			memcpy(payloads.data() + instance.payload, &treeStarts[instance.tree], sizeof(uint32_t));
+
+		PartFileHeader header { PartFileHeader::Magic, PartFileHeader::Version, static_cast<uint32_t>(records.size()), 0, payloads.size() };
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(PartRecord));
+		file.write(payloads.data(), payloads.size());
+		return file.good();
+	}
+
+	// a part tree file mapped into memory, read only to its users
+	class MappedPartTree
+	{
+	public:
+		MappedPartTree() {}
+		~MappedPartTree() { close(); }
+
+		MappedPartTree(const MappedPartTree&) = delete;
+		MappedPartTree& operator=(const MappedPartTree&) = delete;
+
+		// false when the file is missing or isn't a valid part tree
+		bool open(const std::string& path)
+		{
+			close();
+			if (!map(path))
+				return false;
+
+			PartFileHeader header;
+			if (mappedSize < sizeof(header))
+				return fail();
+			memcpy(&header, base, sizeof(header));
+
+			uint64_t recordBytes = uint64_t(header.nodeCount) * sizeof(PartRecord);
+			if (header.magic != PartFileHeader::Magic || header.version != PartFileHeader::Version
+				|| sizeof(header) + recordBytes + header.payloadBytes > mappedSize)
+				return fail();
+
+			records = reinterpret_cast<PartRecord*>(base + sizeof(header));
+			count = header.nodeCount;
+
+			// offsets to pointers, checking on the way that nothing points outside of the file
+			const char* payloads = base + sizeof(header) + recordBytes;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				PartRecord& record = records[i];
+				if (record.subtreeSize == 0 || uint64_t(i) + record.subtreeSize > count
+					|| (record.parent != FlatPartTree::NoParent && record.parent >= i))
+					return fail();
+
+				// the payload has to be exactly what the type reads, and aligned for it to be read in place
+				if (record.type > PartType::Instance || record.payloadSize != payloadSizeOf(record.type))
+					return fail();
+				if (record.payloadSize == 0)
+					record.payload = nullptr;
+				else if (record.payloadOffset % 8 == 0 && record.payloadOffset <= header.payloadBytes
+					&& record.payloadSize <= header.payloadBytes - record.payloadOffset)
+					record.payload = payloads + record.payloadOffset;
+				else
+					return fail();
+
+				// prototypes are roots and come after their instances, so following instances always ends
+				if (record.type == PartType::Instance)
+				{
+					uint32_t prototype = reinterpret_cast<const PartInstanceRecord*>(record.payload)->prototype;
+					if (prototype <= i || prototype >= count || records[prototype].parent != FlatPartTree::NoParent)
+						return fail();
+				}
+			}
+			return true;
+		}
+
+		void close()
+		{
+			unmap();
+			records = nullptr;
+			count = 0;
+		}
+
+		bool isOpen() const { return records != nullptr; }
+		size_t size() const { return count; }
+
+		PartType type(uint32_t node) const { return records[node].type; }
+		uint32_t parent(uint32_t node) const { return records[node].parent; }
+		uint32_t subtreeSize(uint32_t node) const { return records[node].subtreeSize; }
+
+		const Bounds* bounds(uint32_t node) const
+		{
+			return records[node].type == PartType::Graphics ? reinterpret_cast<const Bounds*>(records[node].payload) : nullptr;
+		}
+
+		// prototype and overrides of an Instance, nullptr for the other parts. forEach(instance(node)->prototype)
+		// walks what it stands for
+		const PartInstanceRecord* instance(uint32_t node) const
+		{
+			return records[node].type == PartType::Instance ? reinterpret_cast<const PartInstanceRecord*>(records[node].payload) : nullptr;
+		}
+
+		float mass(uint32_t node) const
+		{
+			float result = 0;
+			if (records[node].type == PartType::Physics)
+				memcpy(&result, records[node].payload, sizeof(result));
+			return result;
+		}
+
+		// visitor(index, record) for every part below and including root, parents first. instances are visited as the
+		// leaves they are in the tree, not descended into
+		template <class Visitor>
+		void forEach(Visitor&& visitor, uint32_t root = 0) const
+		{
+			if (root >= count)
+				return;
+			for (uint32_t i = root, end = root + records[root].subtreeSize; i < end; ++i)
+				visitor(i, records[i]);
+		}
+
+	private:
+		static uint32_t payloadSizeOf(PartType type)
+		{
+			switch (type)
+			{
+			case PartType::Graphics: return sizeof(Bounds);
+			case PartType::Physics: return sizeof(float);
+			case PartType::Instance: return sizeof(PartInstanceRecord);
+			default: return 0;
+			}
+		}
+
+		bool fail()
+		{
+			close();
+			return false;
+		}
+
+#if defined(_WIN32)
+		bool map(const std::string& path)
+		{
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER fileSize;
+			HANDLE mapping = nullptr;
+			if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+				mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (!mapping)
+				return false;
+
+			// copy on write, the fix up never reaches the file
+			base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+			CloseHandle(mapping);
+			mappedSize = base ? static_cast<size_t>(fileSize.QuadPart) : 0;
+			return base != nullptr;
+		}
+
+		void unmap()
+		{
+			if (base)
+				UnmapViewOfFile(base);
+			base = nullptr;
+			mappedSize = 0;
+		}
+#else
+		bool map(const std::string& path)
+		{
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+
+			struct stat status;
+			void* memory = MAP_FAILED;
+			if (fstat(fd, &status) == 0 && status.st_size > 0)
+				memory = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0); // copy on write, the fix up never reaches the file
+			::close(fd);
+			if (memory == MAP_FAILED)
+				return false;
+
+			base = static_cast<char*>(memory);
+			mappedSize = static_cast<size_t>(status.st_size);
+			return true;
+		}
+
+		void unmap()
+		{
+			if (base)
+				munmap(base, mappedSize);
+			base = nullptr;
+			mappedSize = 0;
+		}
+#endif
+
+		char* base = nullptr;
+		size_t mappedSize = 0;
+		PartRecord* records = nullptr;
+		uint32_t count = 0;
+	};
+
+	// asks the os to forget the cached pages of a file, so the next read of it goes to the disk. false where it can't
+	inline bool dropFromPageCache(const std::string& path)
+	{
+#if defined(_WIN32)
+		return false;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		// dirty pages can't be dropped, they are written first
+		bool dropped = fsync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		::close(fd);
+		return dropped;
+#endif
+	}
+
+	// cold start of an assembly of nodeCount parts: building it in code against mapping its saved image. the image is
+	// dropped from the page cache first where the os lets us, otherwise the mapping reads the copy just written
+	inline void benchmarkPartTreeFile(const std::string& path, size_t nodeCount = 500000)
+	{
+		auto milliseconds = [](std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		uint64_t builtMass = 0;
+		double build;
+		{
+			auto start = std::chrono::steady_clock::now();
+			PartArena arena;
+			CarSparePart* root = buildAssemblyWith(nodeCount, 8, [&arena](PartType type) { return createPart(type, arena); });
+
+			// leaf data, as a real assembly would be set up with
+			FlatPartTree flat(root);
+			for (uint32_t i = 0; i < flat.size(); ++i)
+			{
+				if (flat.type(i) == PartType::Physics)
+				{
+					static_cast<Physics*>(flat.source(i))->setMass(float(i % 100));
+					builtMass += i % 100;
+				}
+				else if (flat.type(i) == PartType::Graphics)
+				{
+					Bounds bounds;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						bounds.min[axis] = float(i % 1000);
+						bounds.max[axis] = bounds.min[axis] + 1;
+					}
+					static_cast<Graphics*>(flat.source(i))->setBounds(bounds);
+				}
+			}
+			build = milliseconds(start);
+
+			if (!savePartTree(root, path))
+			{
+				std::cout << "benchmarkPartTreeFile: can't write " << path << std::endl;
+				return;
+			}
+		}
+
+		bool cold = dropFromPageCache(path);
+
+		auto start = std::chrono::steady_clock::now();
+		MappedPartTree mapped;
+		if (!mapped.open(path))
+		{
+			std::cout << "benchmarkPartTreeFile: can't load " << path << std::endl;
+			return;
+		}
+		double load = milliseconds(start);
+
+		uint64_t loadedMass = 0;
+		mapped.forEach([&](uint32_t i, const PartRecord&) { loadedMass += static_cast<uint64_t>(mapped.mass(i)); });
+
+		std::cout << mapped.size() << " parts" << (loadedMass == builtMass ? "" : " (loaded masses differ!)") << std::endl;
+		std::cout << "built in code : " << build << " ms" << std::endl;
+		std::cout << "mapped        : " << load << " ms" << (cold ? ", from disk" : ", from the page cache") << std::endl;
+	}
+}
@@ -0,0 +1,334 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "CompositePattern.h"
+#include "FlatPartTree.h"
+
+namespace composite_pattern
+{
+	// walks part trees on a pool of threads, with the calling thread pitching in.
+	// a task is a subtree, walked depth first with a stack of its own. once a task visited grain parts it hands the
+	// oldest entry of its stack, the biggest subtree left, to its deque where idle threads steal it from. subtrees under
+	// grain parts thus never split, wide and deep trees both end up cut into subtrees of about grain parts.
+	// parents are always visited before their children. visitors mustn't start another traversal on the same scheduler
+	class PartTreeScheduler
+	{
+	public:
+		static const size_t DefaultGrain = 512;
+
+		explicit PartTreeScheduler(unsigned _threads = std::thread::hardware_concurrency())
+			: workers(std::max(_threads, 1u))
+		{
+			for (unsigned i = 0; i + 1 < workers.size(); ++i) // the last worker is whoever calls us
+				threads.emplace_back([this, i] { workerLoop(i); });
+		}
+
+		~PartTreeScheduler()
+		{
+			{
+				std::lock_guard<std::mutex> lock(idleMutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (auto& thread : threads)
+				thread.join();
+		}
+
+		PartTreeScheduler(const PartTreeScheduler&) = delete;
+		PartTreeScheduler& operator=(const PartTreeScheduler&) = delete;
+
+		unsigned threadCount() const { return static_cast<unsigned>(workers.size()); }
+
+		// visitor(part) once for every part, from any thread, in no particular order
+		template <class Visitor>
+		void forEach(CarSparePart* root, Visitor visitor, size_t grain = DefaultGrain)
+		{
+			UnorderedJob<Visitor> job(visitor);
+			run(job, root, nullptr, grain);
+		}
+
+		// fn(part) for every part in parallel, the results come back in the order a sequential depth first walk would
+		// have produced them
+		template <class Fn>
+		auto transform(CarSparePart* root, Fn fn, size_t grain = DefaultGrain) -> std::vector<decltype(fn(root))>
+		{
+			using Result = decltype(fn(root));
+			OrderedJob<Fn, Result> job(fn);
+			typename OrderedJob<Fn, Result>::Segment segment;
+			run(job, root, &segment, grain);
+			return job.gather(segment);
+		}
+
+		// parallel counterpart of root->draw(): the composites draw by recursing, the leaves do the drawing
+		void draw(CarSparePart* root, size_t grain = DefaultGrain)
+		{
+			forEach(root, [](CarSparePart* part)
+			{
+				if (part->childCount() == 0)
+					part->draw();
+			}, grain);
+		}
+
+	private:
+		struct Job;
+
+		struct Task
+		{
+			Job* job;
+			CarSparePart* root;
+			void* segment; // where an ordered job collects the output of this task
+		};
+
+		struct Job
+		{
+			virtual ~Job() {}
+			virtual void visit(CarSparePart* part, void* segment) = 0;
+			virtual void* spawn(void* segment) { return segment; }		// the segment of a subtree split off a task
+			std::atomic<size_t> pending { 0 };
+			size_t grain = DefaultGrain;
+		};
+
+		template <class Visitor>
+		struct UnorderedJob : Job
+		{
+			explicit UnorderedJob(Visitor& _visitor) : visitor(_visitor) {}
+
+			void visit(CarSparePart* part, void*) override
+			{
+				visitor(part);
+			}
+
+			Visitor& visitor;
+		};
+
+		// every task writes to a segment of its own. a task's own output comes before that of the subtrees it spawned,
+		// which come in the reverse order of their spawning: each spawn takes the subtree furthest down the walk
+		template <class Fn, class Result>
+		struct OrderedJob : Job
+		{
+			struct Segment
+			{
+				std::vector<Result> output;
+				std::vector<std::unique_ptr<Segment>> spawned;
+			};
+
+			explicit OrderedJob(Fn& _fn) : fn(_fn) {}
+
+			void visit(CarSparePart* part, void* segment) override
+			{
+				static_cast<Segment*>(segment)->output.push_back(fn(part));
+			}
+
+			// only the thread running the task of parent gets here
+			void* spawn(void* parent) override
+			{
+				Segment* segment = static_cast<Segment*>(parent);
+				segment->spawned.emplace_back(new Segment());
+				return segment->spawned.back().get();
+			}
+
+			std::vector<Result> gather(Segment& root)
+			{
+				std::vector<Result> result;
+				std::vector<Segment*> stack { &root };
+				while (!stack.empty())
+				{
+					Segment* segment = stack.back();
+					stack.pop_back();
+					result.insert(result.end(), std::make_move_iterator(segment->output.begin()), std::make_move_iterator(segment->output.end()));
+					for (auto& spawned : segment->spawned) // the first spawned goes last
+						stack.push_back(spawned.get());
+				}
+				return result;
+			}
+
+			Fn& fn;
+		};
+
+		struct Worker
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;					// the owner works at the back, thieves take from the front
+			std::vector<CarSparePart*> stack;		// scratch space of runTask
+		};
+
+		void run(Job& job, CarSparePart* root, void* segment, size_t grain)
+		{
+			if (!root)
+				return;
+
+			std::lock_guard<std::mutex> runLock(runMutex);
+			job.grain = std::max<size_t>(grain, 1);
+			job.pending.store(1, std::memory_order_relaxed);
+			push(workers.size() - 1, Task { &job, root, segment });
+
+			{
+				std::lock_guard<std::mutex> lock(idleMutex);
+				++activeJobs;
+			}
+			wake.notify_all();
+
+			while (job.pending.load(std::memory_order_acquire) != 0)
+			{
+				if (!runOne(workers.size() - 1))
+					std::this_thread::yield();
+			}
+
+			std::lock_guard<std::mutex> lock(idleMutex);
+			--activeJobs;
+		}
+
+		void workerLoop(unsigned index)
+		{
+			for (;;)
+			{
+				if (runOne(index))
+					continue;
+
+				std::unique_lock<std::mutex> lock(idleMutex);
+				if (stopping)
+					return;
+				if (activeJobs == 0)
+					wake.wait(lock, [this] { return stopping || activeJobs != 0; });
+				else
+				{
+					lock.unlock();
+					std::this_thread::yield(); // a job is running, more work may turn up any moment
+				}
+			}
+		}
+
+		// a task of our own, else one stolen from the others
+		bool runOne(size_t index)
+		{
+			Task task;
+			if (!pop(index, task) && !steal(index, task))
+				return false;
+			runTask(index, task);
+			return true;
+		}
+
+		void runTask(size_t index, const Task& task)
+		{
+			Job& job = *task.job;
+			std::vector<CarSparePart*>& stack = workers[index].stack;
+			stack.assign(1, task.root);
+			size_t bottom = 0;		// entries below bottom were handed out to other tasks
+			size_t sinceSpawn = 0;
+			void* segment = task.segment;
+
+			while (stack.size() > bottom)
+			{
+				CarSparePart* part = stack.back();
+				stack.pop_back();
+				job.visit(part, segment);
+
+				for (size_t i = part->childCount(); i > 0; --i)
+					stack.push_back(*part->getChildIterator(static_cast<unsigned>(i - 1)));
+
+				if (++sinceSpawn >= job.grain && stack.size() - bottom > 1)
+				{
+					job.pending.fetch_add(1, std::memory_order_relaxed);
+					push(index, Task { &job, stack[bottom++], job.spawn(segment) });
+					sinceSpawn = 0;
+				}
+			}
+
+			job.pending.fetch_sub(1, std::memory_order_release);
+		}
+
+		void push(size_t index, const Task& task)
+		{
+			std::lock_guard<std::mutex> lock(workers[index].mutex);
+			workers[index].tasks.push_back(task);
+		}
+
+		bool pop(size_t index, Task& task)
+		{
+			std::lock_guard<std::mutex> lock(workers[index].mutex);
+			if (workers[index].tasks.empty())
+				return false;
+			task = workers[index].tasks.back();
+			workers[index].tasks.pop_back();
+			return true;
+		}
+
+		bool steal(size_t index, Task& task)
+		{
+			for (size_t i = 1; i < workers.size(); ++i)
+			{
+				Worker& victim = workers[(index + i) % workers.size()];
+				std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+				if (!lock.owns_lock() || victim.tasks.empty())
+					continue;
+				task = victim.tasks.front();
+				victim.tasks.pop_front();
+				return true;
+			}
+			return false;
+		}
+
+		std::vector<Worker> workers;
+		std::vector<std::thread> threads;
+		std::mutex runMutex; // the calling thread's worker slot is shared, one traversal at a time
+
+		std::mutex idleMutex;
+		std::condition_variable wake;
+		size_t activeJobs = 0;
+		bool stopping = false;
+	};
+
+	// parts per second of a single threaded walk against the scheduler, on a wide and on a deep tree of nodeCount parts.
+	// every part gets a bit of arithmetic so there is something to spread over the threads
+	inline void benchmarkPartTreeScheduler(size_t nodeCount = 1000000, unsigned threads = std::thread::hardware_concurrency())
+	{
+		auto work = [](CarSparePart* part)
+		{
+			uint64_t hash = reinterpret_cast<uintptr_t>(part);
+			for (int i = 0; i < 64; ++i)
+				hash = hash * 6364136223846793005ull + 1442695040888963407ull;
+			return hash;
+		};
+
+		PartTreeScheduler single(1);
+		PartTreeScheduler parallel(threads);
+
+		struct Shape
+		{
+			const char* name;
+			size_t fanOut;
+		};
+		for (Shape shape : { Shape { "wide (64 children)", 64 }, Shape { "deep (2 children)", 2 } })
+		{
+			std::vector<std::unique_ptr<CarSparePart>> storage;
+			CarSparePart* root = buildAssembly(nodeCount, shape.fanOut, storage);
+
+			auto measure = [&](PartTreeScheduler& scheduler)
+			{
+				std::atomic<uint64_t> checksum { 0 };
+				auto start = std::chrono::steady_clock::now();
+				scheduler.forEach(root, [&](CarSparePart* part) { checksum.fetch_xor(work(part), std::memory_order_relaxed); });
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				return double(storage.size()) / seconds;
+			};
+
+			double one = measure(single);
+			double many = measure(parallel);
+			std::cout << shape.name << ": 1 thread " << one / 1e6 << " M parts/s, " << parallel.threadCount() << " threads "
+				<< many / 1e6 << " M parts/s (x" << many / one << ")" << std::endl;
+
+			auto start = std::chrono::steady_clock::now();
+			std::vector<uint64_t> ordered = parallel.transform(root, work);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "  ordered transform " << double(ordered.size()) / seconds / 1e6 << " M parts/s" << std::endl;
+		}
+	}
+}
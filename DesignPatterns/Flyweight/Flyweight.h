@@ -2,6 +2,13 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdint>
 
 namespace flyweight_pattern
 {
@@ -13,7 +20,8 @@ namespace flyweight_pattern
 		NavySeal,
 		GreenBeret,
 		Marine,
-		Sniper
+		Sniper,
+		Count
 	};
 
 	enum class SoldierTexture_Uniform
@@ -23,6 +31,7 @@ namespace flyweight_pattern
 		Green_BlackStripesCamo,
 		Black,
 		DarkBlue_LightBlueStripesCamo,
+		Count
 	};
 
 	enum class SoldierTexture_Gloves
@@ -30,7 +39,8 @@ namespace flyweight_pattern
 		Black,
 		DarkGrey,
 		BlackAndGrey,
-		Olive
+		Olive,
+		Count
 	};
 
 	enum class SoldierTexture_Glasses
@@ -39,20 +49,23 @@ namespace flyweight_pattern
 		AviatorGolden,
 		AviatorSilver,
 		Wayfarer,
-		Sporty
+		Sporty,
+		Count
 	};
 
 	enum class SoldierTexture_Helmet
 	{
 		BlackSF,
 		OliveSF,
-		Green
+		Green,
+		Count
 	};
 
 	enum class SoldierTexture_Boots
 	{
 		Black,
-		BlackLong
+		BlackLong,
+		Count
 	};
 
 	// intrinsic state
@@ -61,8 +74,19 @@ namespace flyweight_pattern
 	class Animation{};
 
 	// extrinsic state
-	class Position{};
-	class Orientation{};
+	struct Vec3
+	{
+		float x = 0, y = 0, z = 0;
+	};
+
+	// rotation as a unit quaternion, identity by default
+	struct Quat
+	{
+		float x = 0, y = 0, z = 0, w = 1;
+	};
+
+	using Position = Vec3;
+	using Orientation = Quat;
 	class Color{};
 
 	// different for different soldiers
@@ -75,8 +99,24 @@ namespace flyweight_pattern
 		int64_t id;
 	};
 
+	// extrinsic states of many soldiers sharing one flyweight, laid out array by array, down to the components
+	struct SoldierBatch
+	{
+		size_t count;
+		const float* x;
+		const float* y;
+		const float* z;
+		const float* qx;
+		const float* qy;
+		const float* qz;
+		const float* qw;
+		const Color* colors;
+		const int64_t* ids;
+	};
+
 	struct NPCSoldierBase_Flyweight
 	{
+		virtual ~NPCSoldierBase_Flyweight() {}
 		virtual bool Load() = 0;
 		virtual void Unload() = 0;
 		virtual void Draw(const ExtrinsicState_Soldier& _drawParams) const = 0;
@@ -92,11 +132,61 @@ namespace flyweight_pattern
 		SoldierTexture_Boots boots;
 	};
 
+	// the whole policy by value in one integer, four bits a field. two policies pack the same exactly when they are equal
+	using PolicyKey = uint32_t;
+
+	// Count closes every policy enum, whatever gets added before it is checked too
+	static_assert(static_cast<int>(SoldierTypes::Count) <= 16 && static_cast<int>(SoldierTexture_Uniform::Count) <= 16
+		&& static_cast<int>(SoldierTexture_Gloves::Count) <= 16 && static_cast<int>(SoldierTexture_Glasses::Count) <= 16
+		&& static_cast<int>(SoldierTexture_Helmet::Count) <= 16 && static_cast<int>(SoldierTexture_Boots::Count) <= 16,
+		"a policy field outgrew its four bits");
+
+	constexpr PolicyKey packPolicy(const SoldierPolicy& _policy)
+	{
+		return static_cast<PolicyKey>(_policy.type)
+			| static_cast<PolicyKey>(_policy.uniform) << 4
+			| static_cast<PolicyKey>(_policy.gloves) << 8
+			| static_cast<PolicyKey>(_policy.glasses) << 12
+			| static_cast<PolicyKey>(_policy.helmet) << 16
+			| static_cast<PolicyKey>(_policy.boots) << 20;
+	}
+
+	constexpr SoldierPolicy unpackPolicy(PolicyKey _key)
+	{
+		return SoldierPolicy { static_cast<SoldierTypes>(_key & 15), static_cast<SoldierTexture_Uniform>(_key >> 4 & 15),
+			static_cast<SoldierTexture_Gloves>(_key >> 8 & 15), static_cast<SoldierTexture_Glasses>(_key >> 12 & 15),
+			static_cast<SoldierTexture_Helmet>(_key >> 16 & 15), static_cast<SoldierTexture_Boots>(_key >> 20 & 15) };
+	}
+
 	//Policy Flyweights
-	const SoldierPolicy ParaSF { SoldierTypes::ParaSF, SoldierTexture_Uniform::Green_DarkGreenStripesCamo, SoldierTexture_Gloves::Olive, SoldierTexture_Glasses::None, SoldierTexture_Helmet::OliveSF, SoldierTexture_Boots::BlackLong };
-	const SoldierPolicy Normal { SoldierTypes::Normal, SoldierTexture_Uniform::Green_Camouflage, SoldierTexture_Gloves::Olive, SoldierTexture_Glasses::None, SoldierTexture_Helmet::Green, SoldierTexture_Boots::Black };
-	const SoldierPolicy Marcos { SoldierTypes::Marcos, SoldierTexture_Uniform::Black, SoldierTexture_Gloves::Black, SoldierTexture_Glasses::None, SoldierTexture_Helmet::BlackSF, SoldierTexture_Boots::BlackLong };
-	const SoldierPolicy NvSeal { SoldierTypes::NavySeal, SoldierTexture_Uniform::Green_BlackStripesCamo, SoldierTexture_Gloves::Black, SoldierTexture_Glasses::None, SoldierTexture_Helmet::BlackSF, SoldierTexture_Boots::BlackLong };
+	constexpr SoldierPolicy ParaSF { SoldierTypes::ParaSF, SoldierTexture_Uniform::Green_DarkGreenStripesCamo, SoldierTexture_Gloves::Olive, SoldierTexture_Glasses::None, SoldierTexture_Helmet::OliveSF, SoldierTexture_Boots::BlackLong };
+	constexpr SoldierPolicy Normal { SoldierTypes::Normal, SoldierTexture_Uniform::Green_Camouflage, SoldierTexture_Gloves::Olive, SoldierTexture_Glasses::None, SoldierTexture_Helmet::Green, SoldierTexture_Boots::Black };
+	constexpr SoldierPolicy Marcos { SoldierTypes::Marcos, SoldierTexture_Uniform::Black, SoldierTexture_Gloves::Black, SoldierTexture_Glasses::None, SoldierTexture_Helmet::BlackSF, SoldierTexture_Boots::BlackLong };
+	constexpr SoldierPolicy NvSeal { SoldierTypes::NavySeal, SoldierTexture_Uniform::Green_BlackStripesCamo, SoldierTexture_Gloves::Black, SoldierTexture_Glasses::None, SoldierTexture_Helmet::BlackSF, SoldierTexture_Boots::BlackLong };
+
+	// the named policies by key, built by the compiler. the factory makes their flyweights when it is constructed and
+	// keeps their slots in a plain array indexed by position in this table, see NPCSoldierFlyweightFactory::create<Key>()
+	constexpr PolicyKey namedPolicyKeys[] = { packPolicy(Normal), packPolicy(ParaSF), packPolicy(Marcos), packPolicy(NvSeal) };
+	constexpr size_t NamedPolicyCount = sizeof(namedPolicyKeys) / sizeof(namedPolicyKeys[0]);
+
+	// NamedPolicyCount for a key that isn't named
+	constexpr size_t namedPolicyIndex(PolicyKey _key)
+	{
+		for (size_t i = 0; i < NamedPolicyCount; ++i)
+			if (namedPolicyKeys[i] == _key)
+				return i;
+		return NamedPolicyCount;
+	}
+
+	constexpr bool namedPolicyKeysUnique()
+	{
+		for (size_t i = 0; i < NamedPolicyCount; ++i)
+			if (namedPolicyIndex(namedPolicyKeys[i]) != i)
+				return false;
+		return true;
+	}
+
+	static_assert(namedPolicyKeysUnique(), "two named policies are the same policy");
 
 	// shared flyweight
 	struct NPCSoldierFlyweightConcrete : public NPCSoldierBase_Flyweight
@@ -110,44 +200,216 @@ namespace flyweight_pattern
 
 		Animation animations[10];
 		
+		SoldierPolicy ownPolicy;		// a copy, the flyweight outlives whatever policy it was asked for with
 		const SoldierPolicy* policy;
 
-		NPCSoldierFlyweightConcrete(const SoldierPolicy* _pol): policy(_pol) {}
+		// stands in for the meshes, textures and animations once they are in memory
+		std::vector<char> resident;
+		std::atomic<bool> ready { false };	// loaded and safe to draw with, see FlyweightStreamer
+
+		NPCSoldierFlyweightConcrete(const SoldierPolicy* _pol): ownPolicy(*_pol), policy(&ownPolicy) {}
+		explicit NPCSoldierFlyweightConcrete(PolicyKey _key): ownPolicy(unpackPolicy(_key)), policy(&ownPolicy) {}
 		
-		void Unload() override {/*Unload Policy*/ };
-		bool Load() override {/*Load Policy*/}
+		// what the assets of the policy take once loaded: the meshes, a texture per item and the animations
+		size_t AssetBytes() const
+		{
+			size_t textures = 5 * 256 * 1024 + (ownPolicy.glasses == SoldierTexture_Glasses::None ? 0 : 64 * 1024);
+			return 5 * 128 * 1024 + textures + 10 * 64 * 1024;
+		}
+
+		void Unload() override
+		{
+			ready.store(false, std::memory_order_relaxed);
+			std::vector<char>().swap(resident);
+		}
+
+		bool Load() override
+		{
+			resident.assign(AssetBytes(), 0);
+			return true;
+		}
+
+		// what one flyweight costs, assets included whether they are loaded right now or not
+		size_t IntrinsicBytes() const
+		{
+			return sizeof(*this) + AssetBytes();
+		}
 		void Draw(const ExtrinsicState_Soldier& _drawParams) const override {}
+
+		// one instanced draw call for the whole batch
+		void DrawInstanced(const SoldierBatch&) const {}
 	};
 
+	// one flyweight per distinct policy value, in an open addressing table of fixed size indexed by the packed policy.
+	// lookups take no lock and write nothing shared but the use counter of their slot. a miss claims a slot with a
+	// compare and swap of its key; threads racing for the same new policy wait for the winner to publish its flyweight.
+	// the table never grows: the default size holds every combination the policy enums allow
 	struct NPCSoldierFlyweightFactory
 	{
 	public:
+		struct Stats
+		{
+			uint64_t lookups;	// one per soldier handed its flyweight
+			uint64_t created;
+			uint64_t inUse;		// flyweights looked up at least once, the named ones are made whether asked for or not
+
+			// soldiers per flyweight in use, the same measure as FlyweightFootprint::soldiersPerFlyweight()
+			double soldiersPerFlyweight() const { return inUse ? double(lookups) / double(inUse) : 0; }
+		};
+
+		explicit NPCSoldierFlyweightFactory(size_t _capacity = 8192)
+			: slots(roundUp(_capacity))
+			, mask(slots.size() - 1)
+		{
+			// the table holds at least 16, there is always room for the named ones
+			for (size_t i = 0; i < NamedPolicyCount; ++i)
+				namedSlots[i] = find(namedPolicyKeys[i]);
+		}
+
+		~NPCSoldierFlyweightFactory()
+		{
+			for (auto& slot : slots)
+				delete slot.flyweight.load(std::memory_order_relaxed);
+		}
+
+		NPCSoldierFlyweightFactory(const NPCSoldierFlyweightFactory&) = delete;
+		NPCSoldierFlyweightFactory& operator=(const NPCSoldierFlyweightFactory&) = delete;
+
+		// the flyweight shared by every soldier of this policy, nullptr only once the table is full
 		NPCSoldierFlyweightConcrete* create(const SoldierPolicy* _policy)
 		{
-			auto result = std::find_if(sharedFlyweights.begin(), sharedFlyweights.end(), [_policy] (const NPCSoldierFlyweightConcrete* _soldier)
+			return create(packPolicy(*_policy));
+		}
+
+		NPCSoldierFlyweightConcrete* create(PolicyKey _key)
+		{
+			Slot* slot = find(_key);
+			if (!slot)
+				return nullptr;
+			slot->uses.fetch_add(1, std::memory_order_relaxed);
+			return slot->flyweight.load(std::memory_order_relaxed);
+		}
+
+		// a named policy known at compile time, e.g. create<packPolicy(ParaSF)>(): the index into the slots resolved by
+		// the constructor is a constant, nothing is hashed, probed or initialized. the use count is still kept, the
+		// stats are built from it like for every other policy
+		template <PolicyKey Key>
+		NPCSoldierFlyweightConcrete* create()
+		{
+			static_assert(namedPolicyIndex(Key) < NamedPolicyCount, "not a named policy, use create(key)");
+			Slot* slot = namedSlots[namedPolicyIndex(Key)];
+			slot->uses.fetch_add(1, std::memory_order_relaxed);
+			return slot->flyweight.load(std::memory_order_relaxed);
+		}
+
+		// f(flyweight, uses) for every flyweight made so far
+		template <class F>
+		void forEachFlyweight(F&& f) const
+		{
+			for (auto& slot : slots)
 			{
-				return _soldier->policy == _policy;
-			});
+				if (const NPCSoldierFlyweightConcrete* flyweight = slot.flyweight.load(std::memory_order_acquire))
+					f(*flyweight, slot.uses.load(std::memory_order_relaxed));
+			}
+		}
 
-			NPCSoldierFlyweightConcrete* found = nullptr;
+		// the table itself, without the flyweights
+		size_t TableBytes() const
+		{
+			return sizeof(*this) + slots.capacity() * sizeof(Slot);
+		}
 
-			if (result == sharedFlyweights.end())
+		Stats stats() const
+		{
+			uint64_t lookups = 0, inUse = 0;
+			for (auto& slot : slots)
 			{
-				found = new NPCSoldierFlyweightConcrete(_policy);
+				uint64_t uses = slot.uses.load(std::memory_order_relaxed);
+				lookups += uses;
+				inUse += uses != 0;
 			}
-			else
+			return Stats { lookups, created.load(std::memory_order_relaxed), inUse };
+		}
+
+	private:
+		struct Slot
+		{
+			std::atomic<uint32_t> key { 0 };
+			std::atomic<NPCSoldierFlyweightConcrete*> flyweight { nullptr };
+			std::atomic<uint64_t> uses { 0 };	// per slot, spawners of different policies don't fight over a counter
+		};
+
+		// the slot of the policy with its flyweight published, claiming and filling it on a miss
+		Slot* find(PolicyKey _key)
+		{
+			uint32_t key = _key + 1; // 0 marks an empty slot
+			for (size_t probe = 0, index = hash(key) & mask; probe < slots.size(); ++probe, index = (index + 1) & mask)
 			{
-				found = *result;
+				Slot& slot = slots[index];
+				uint32_t slotKey = slot.key.load(std::memory_order_acquire);
+
+				if (slotKey == 0)
+				{
+					// claim the slot, or find out who was faster and what for
+					if (slot.key.compare_exchange_strong(slotKey, key, std::memory_order_acq_rel))
+					{
+						slot.flyweight.store(new NPCSoldierFlyweightConcrete(_key), std::memory_order_release);
+						created.fetch_add(1, std::memory_order_relaxed);
+						return &slot;
+					}
+				}
+
+				if (slotKey != key)
+					continue;
+
+				while (!slot.flyweight.load(std::memory_order_acquire))
+					std::this_thread::yield(); // claimed a moment ago, the flyweight is being made
+				return &slot;
 			}
+			return nullptr;
+		}
 
-			return found;
+		static size_t roundUp(size_t capacity)
+		{
+			size_t rounded = 16;
+			while (rounded < capacity)
+				rounded *= 2;
+			return rounded;
 		}
-	private:
-		std::vector<NPCSoldierFlyweightConcrete*> sharedFlyweights;
+
+		static size_t hash(uint32_t key)
+		{
+			key ^= key >> 16; // murmur3 finalizer, neighbouring policies land far apart
+			key *= 0x85ebca6bu;
+			key ^= key >> 13;
+			key *= 0xc2b2ae35u;
+			key ^= key >> 16;
+			return key;
+		}
+
+		std::vector<Slot> slots;
+		size_t mask;
+		std::atomic<uint64_t> created { 0 };
+		Slot* namedSlots[NamedPolicyCount];	// set by the constructor, read only from then on
 	};
 
 	NPCSoldierFlyweightFactory factory;
 
+	// the _index-th of the policies the benchmarks spread their soldiers over, the first few dozen all different
+	inline SoldierPolicy samplePolicy(size_t _index)
+	{
+		return SoldierPolicy { static_cast<SoldierTypes>(_index % 7), static_cast<SoldierTexture_Uniform>(_index % 5),
+			static_cast<SoldierTexture_Gloves>(_index % 4), static_cast<SoldierTexture_Glasses>(_index / 12 % 5),
+			static_cast<SoldierTexture_Helmet>(_index % 3), static_cast<SoldierTexture_Boots>(_index % 2) };
+	}
+
+	// time since _start, in seconds unless told otherwise, e.g. elapsed<std::milli>(start)
+	template <class Period = std::ratio<1>>
+	inline double elapsed(std::chrono::steady_clock::time_point _start)
+	{
+		return std::chrono::duration<double, Period>(std::chrono::steady_clock::now() - _start).count();
+	}
+
 	struct NPCSoldierUnsharedFlyweight: public NPCSoldierBase_Flyweight
 	{
 		ExtrinsicState_Soldier state;
@@ -165,7 +427,7 @@ namespace flyweight_pattern
 
 		bool Load() override
 		{
-			flyweight->Load();
+			return flyweight->Load();
 		}
 
 		void Unload() override
@@ -177,6 +439,13 @@ namespace flyweight_pattern
 		{
 			Draw(this->state);
 		}
+
+		// the soldier object and its name, the flyweight it points at not included
+		size_t ExtrinsicBytes() const
+		{
+			size_t nameBytes = state.name.capacity() > std::string().capacity() ? state.name.capacity() + 1 : 0; // past the in place buffer
+			return sizeof(*this) + nameBytes;
+		}
 	};
 
 	std::vector<NPCSoldierUnsharedFlyweight*> soldiers;
@@ -184,5 +453,64 @@ namespace flyweight_pattern
 	NPCSoldierUnsharedFlyweight* AddSoldiers(const ExtrinsicState_Soldier& state, const SoldierPolicy* _policy)
 	{
 		soldiers.push_back(new NPCSoldierUnsharedFlyweight(state, factory.create(_policy)));
+		return soldiers.back();
+	}
+
+	// a million flyweight lookups spread over threads, for policies drawn at random out of a few dozen distinct ones
+	inline void benchmarkFlyweightFactory(size_t spawns = 1000000, unsigned threads = std::thread::hardware_concurrency())
+	{
+		threads = std::max(threads, 1u);
+
+		// distinct values, each one at its own address like policies read from data would be
+		std::vector<SoldierPolicy> policies;
+		for (size_t i = 0; i < 48; ++i)
+			policies.push_back(samplePolicy(i));
+		std::vector<SoldierPolicy> copies(policies.begin(), policies.end());
+
+		NPCSoldierFlyweightFactory shared;
+		std::atomic<size_t> misses { 0 };
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> spawners;
+		for (unsigned t = 0; t < threads; ++t)
+		{
+			spawners.emplace_back([&, t]
+			{
+				std::minstd_rand random(t + 1);
+				for (size_t i = t; i < spawns; i += threads)
+				{
+					const std::vector<SoldierPolicy>& source = random() % 2 ? policies : copies;
+					if (!shared.create(&source[random() % source.size()]))
+						++misses;
+				}
+			});
+		}
+		for (auto& spawner : spawners)
+			spawner.join();
+		double seconds = elapsed(start);
+
+		NPCSoldierFlyweightFactory::Stats stats = shared.stats();
+		std::cout << spawns << " spawns on " << threads << " threads: " << double(spawns) / seconds / 1e6 << " M spawns/s" << std::endl;
+		std::cout << stats.inUse << " flyweights in use for " << stats.lookups << " soldiers, " << stats.soldiersPerFlyweight() << " soldiers per flyweight"
+			<< (misses ? ", table full!" : "") << std::endl;
+
+		// the named policies on one thread, through the hashed table and through the compile time table
+		const PolicyKey keys[] = { packPolicy(Normal), packPolicy(ParaSF), packPolicy(Marcos), packPolicy(NvSeal) };
+		size_t found = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < spawns; ++i)
+			found += shared.create(keys[i % 4]) != nullptr;
+		double hashed = elapsed<std::nano>(start) / double(spawns);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < spawns; i += 4)
+		{
+			found += shared.create<packPolicy(Normal)>() != nullptr;
+			found += shared.create<packPolicy(ParaSF)>() != nullptr;
+			found += shared.create<packPolicy(Marcos)>() != nullptr;
+			found += shared.create<packPolicy(NvSeal)>() != nullptr;
+		}
+		double named = elapsed<std::nano>(start) / double(spawns);
+		std::cout << "named policies: " << hashed << " ns hashed, " << named << " ns through create<Key>() (" << found << ")" << std::endl;
 	}
 }
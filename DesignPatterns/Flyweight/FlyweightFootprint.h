@@ -0,0 +1,137 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <random>
+#include <iostream>
+#include <cstdint>
+#include "Flyweight.h"
+#include "SoldierStore.h"
+
+namespace flyweight_pattern
+{
+	// what the soldiers and their flyweights take in memory, against what they would take without the flyweights.
+	// taken at one moment by measureFootprint, nothing is counted along the way
+	struct FlyweightFootprint
+	{
+		size_t soldiers = 0;
+		size_t flyweights = 0;		// unique ones, every flyweight the factory made
+		size_t flyweightsInUse = 0;	// the ones at least one of the soldiers points at
+		size_t intrinsicBytes = 0;	// the flyweights, assets included
+		size_t extrinsicBytes = 0;	// the soldier container with everything it holds
+		size_t factoryBytes = 0;	// the lookup table
+		size_t unsharedBytes = 0;	// the soldiers each carrying their own copy of their flyweight, and no factory
+
+		// flyweights made but not used don't count, the same measure as NPCSoldierFlyweightFactory::Stats
+		double soldiersPerFlyweight() const { return flyweightsInUse ? double(soldiers) / double(flyweightsInUse) : 0; }
+		double extrinsicBytesPerSoldier() const { return soldiers ? double(extrinsicBytes) / double(soldiers) : 0; }
+		size_t totalBytes() const { return intrinsicBytes + extrinsicBytes + factoryBytes; }
+		int64_t savedBytes() const { return int64_t(unsharedBytes) - int64_t(totalBytes()); }
+
+		std::string toJson() const
+		{
+			std::ostringstream json;
+			json << "{\n"
+				<< "\t\"soldiers\": " << soldiers << ",\n"
+				<< "\t\"flyweights\": " << flyweights << ",\n"
+				<< "\t\"flyweightsInUse\": " << flyweightsInUse << ",\n"
+				<< "\t\"soldiersPerFlyweight\": " << soldiersPerFlyweight() << ",\n"
+				<< "\t\"intrinsicBytes\": " << intrinsicBytes << ",\n"
+				<< "\t\"extrinsicBytes\": " << extrinsicBytes << ",\n"
+				<< "\t\"extrinsicBytesPerSoldier\": " << extrinsicBytesPerSoldier() << ",\n"
+				<< "\t\"factoryBytes\": " << factoryBytes << ",\n"
+				<< "\t\"totalBytes\": " << totalBytes() << ",\n"
+				<< "\t\"unsharedBytes\": " << unsharedBytes << ",\n"
+				<< "\t\"savedBytes\": " << savedBytes() << "\n"
+				<< "}\n";
+			return json.str();
+		}
+
+		bool saveJson(const std::string& path) const
+		{
+			std::ofstream file(path, std::ios::trunc);
+			file << toJson();
+			return file.good();
+		}
+	};
+
+	inline void measureFactory(const NPCSoldierFlyweightFactory& factory, FlyweightFootprint& footprint)
+	{
+		footprint.factoryBytes = factory.TableBytes();
+		factory.forEachFlyweight([&footprint](const NPCSoldierFlyweightConcrete& flyweight, uint64_t)
+		{
+			++footprint.flyweights;
+			footprint.intrinsicBytes += flyweight.IntrinsicBytes();
+		});
+	}
+
+	// soldiers as objects, like the soldiers vector keeps them
+	inline FlyweightFootprint measureFootprint(const NPCSoldierFlyweightFactory& factory, const std::vector<NPCSoldierUnsharedFlyweight*>& soldiers)
+	{
+		FlyweightFootprint footprint;
+		measureFactory(factory, footprint);
+
+		footprint.soldiers = soldiers.size();
+		footprint.extrinsicBytes = soldiers.capacity() * sizeof(NPCSoldierUnsharedFlyweight*);
+		std::vector<const NPCSoldierFlyweightConcrete*> used;
+		for (const NPCSoldierUnsharedFlyweight* soldier : soldiers)
+		{
+			footprint.extrinsicBytes += soldier->ExtrinsicBytes();
+			footprint.unsharedBytes += soldier->flyweight->IntrinsicBytes();
+			used.push_back(soldier->flyweight);
+		}
+		std::sort(used.begin(), used.end());
+		footprint.flyweightsInUse = size_t(std::unique(used.begin(), used.end()) - used.begin());
+		footprint.unsharedBytes += footprint.extrinsicBytes;
+		return footprint;
+	}
+
+	inline FlyweightFootprint measureFootprint(const NPCSoldierFlyweightFactory& factory, const SoldierStore& store)
+	{
+		FlyweightFootprint footprint;
+		measureFactory(factory, footprint);
+
+		footprint.soldiers = store.size();
+		footprint.extrinsicBytes = store.ExtrinsicBytes();
+		store.forEachBatch([&footprint](const NPCSoldierFlyweightConcrete& flyweight, const SoldierBatch& batch)
+		{
+			++footprint.flyweightsInUse; // a batch per flyweight
+			footprint.unsharedBytes += batch.count * flyweight.IntrinsicBytes();
+		});
+		footprint.unsharedBytes += footprint.extrinsicBytes;
+		return footprint;
+	}
+
+	// soldierCount soldiers of a few dozen policies, kept as objects and in a SoldierStore
+	inline void printFlyweightFootprint(size_t soldierCount = 100000, size_t flyweightCount = 48)
+	{
+		NPCSoldierFlyweightFactory flyweights;
+		std::vector<NPCSoldierFlyweightConcrete*> kinds;
+		for (size_t i = 0; i < flyweightCount; ++i)
+		{
+			SoldierPolicy policy = samplePolicy(i);
+			kinds.push_back(flyweights.create(&policy));
+		}
+
+		std::minstd_rand random(13);
+		std::vector<NPCSoldierUnsharedFlyweight*> objects;
+		SoldierStore store;
+		for (size_t i = 0; i < soldierCount; ++i)
+		{
+			ExtrinsicState_Soldier state {};
+			state.id = static_cast<int64_t>(i);
+			state.name = "Soldier " + std::to_string(i);
+			NPCSoldierFlyweightConcrete* kind = kinds[random() % kinds.size()];
+			objects.push_back(new NPCSoldierUnsharedFlyweight(state, kind));
+			store.add(state, kind);
+		}
+
+		std::cout << "soldiers as objects:\n" << measureFootprint(flyweights, objects).toJson();
+		std::cout << "soldier store:\n" << measureFootprint(flyweights, store).toJson();
+
+		for (NPCSoldierUnsharedFlyweight* soldier : objects)
+			delete soldier;
+	}
+}
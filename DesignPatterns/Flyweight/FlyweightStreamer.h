@@ -0,0 +1,309 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdint>
+#include "Flyweight.h"
+
+namespace flyweight_pattern
+{
+	struct FlyweightStreamerConfig
+	{
+		size_t memoryBudget = 64 * 1024 * 1024;	// resident assets beyond this get evicted, least recently used first
+		unsigned loaderThreads = 2;
+	};
+
+	// loads the assets of flyweights in the background and unloads them again once unused and memory is short.
+	// soldiers hold a reference on their flyweight through acquire and release; acquiring never waits, a flyweight
+	// still loading is drawn as the placeholder. the loaders only load, every state change happens in update(),
+	// called once a frame by the simulation thread which is also the one drawing
+	class FlyweightStreamer
+	{
+	public:
+		// does the actual I/O, on a loader thread
+		using Loader = std::function<bool(NPCSoldierFlyweightConcrete&)>;
+
+		struct Stats
+		{
+			uint64_t loads;
+			uint64_t failedLoads;
+			uint64_t evictions;
+			size_t residentBytes;
+			size_t loading;
+		};
+
+		explicit FlyweightStreamer(const FlyweightStreamerConfig& _config = FlyweightStreamerConfig(),
+			Loader _loader = [](NPCSoldierFlyweightConcrete& _flyweight) { return _flyweight.Load(); })
+			: config(_config)
+			, loader(std::move(_loader))
+			, placeholderFlyweight(&Normal)
+		{
+			// the placeholder is small and always there
+			placeholderFlyweight.resident.assign(64 * 1024, 0);
+			placeholderFlyweight.ready.store(true, std::memory_order_release);
+
+			for (unsigned i = 0; i < std::max(config.loaderThreads, 1u); ++i)
+				loaders.emplace_back([this] { loaderLoop(); });
+		}
+
+		~FlyweightStreamer()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopping = true;
+			}
+			queueReady.notify_all();
+			for (auto& thread : loaders)
+				thread.join();
+
+			// loads that finished after the last update never made it past Loading
+			for (auto& item : entries)
+				if (item.second.state != State::Unloaded)
+					item.first->Unload();
+		}
+
+		FlyweightStreamer(const FlyweightStreamer&) = delete;
+		FlyweightStreamer& operator=(const FlyweightStreamer&) = delete;
+
+		// one more soldier uses the flyweight, queues its loading if it isn't in memory
+		void acquire(NPCSoldierFlyweightConcrete* _flyweight)
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			Entry& entry = entries[_flyweight];
+			if (entry.references++ == 0 && entry.inLru)
+			{
+				lru.erase(entry.lruPosition);
+				entry.inLru = false;
+			}
+
+			if (entry.state == State::Unloaded)
+			{
+				entry.state = State::Loading;
+				++loading;
+				{
+					std::lock_guard<std::mutex> queueLock(queueMutex);
+					queue.push_back(_flyweight);
+				}
+				queueReady.notify_one();
+			}
+		}
+
+		// a soldier using the flyweight is gone. the last one leaves it resident until memory runs short
+		void release(NPCSoldierFlyweightConcrete* _flyweight)
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			auto found = entries.find(_flyweight);
+			if (found == entries.end() || found->second.references == 0)
+				return;
+
+			Entry& entry = found->second;
+			if (--entry.references == 0 && entry.state == State::Resident)
+				makeEvictable(_flyweight, entry);
+		}
+
+		// the flyweight to draw with: the real one once loaded, else the placeholder. takes no lock
+		const NPCSoldierFlyweightConcrete& resolve(const NPCSoldierFlyweightConcrete* _flyweight) const
+		{
+			return _flyweight->ready.load(std::memory_order_acquire) ? *_flyweight : placeholderFlyweight;
+		}
+
+		const NPCSoldierFlyweightConcrete& placeholder() const { return placeholderFlyweight; }
+
+		// once a frame on the simulation thread: makes finished loads visible, then evicts unused flyweights while over
+		// budget. flyweights still in use are never evicted, even over budget. returns the number of flyweights evicted
+		size_t update()
+		{
+			std::vector<std::pair<NPCSoldierFlyweightConcrete*, bool>> finished;
+			{
+				std::lock_guard<std::mutex> queueLock(queueMutex);
+				finished.swap(completed);
+			}
+
+			std::lock_guard<std::mutex> lock(stateMutex);
+			for (auto& load : finished)
+			{
+				NPCSoldierFlyweightConcrete* flyweight = load.first;
+				Entry& entry = entries[flyweight];
+				--loading;
+
+				if (!load.second)
+				{
+					entry.state = State::Unloaded; // acquiring it again retries
+					++counters.failedLoads;
+					continue;
+				}
+
+				entry.state = State::Resident;
+				entry.bytes = flyweight->resident.size();
+				residentBytes += entry.bytes;
+				flyweight->ready.store(true, std::memory_order_release);
+				++counters.loads;
+
+				if (entry.references == 0)
+					makeEvictable(flyweight, entry);
+			}
+
+			size_t evicted = 0;
+			while (residentBytes > config.memoryBudget && !lru.empty())
+			{
+				NPCSoldierFlyweightConcrete* flyweight = lru.back();
+				Entry& entry = entries[flyweight];
+				lru.pop_back();
+				entry.inLru = false;
+
+				flyweight->Unload();
+				residentBytes -= entry.bytes;
+				entry.bytes = 0;
+				entry.state = State::Unloaded;
+				++evicted;
+			}
+			counters.evictions += evicted;
+			return evicted;
+		}
+
+		Stats stats() const
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			return Stats { counters.loads, counters.failedLoads, counters.evictions, residentBytes, loading };
+		}
+
+	private:
+		enum class State
+		{
+			Unloaded,
+			Loading,
+			Resident,
+		};
+
+		struct Entry
+		{
+			size_t references = 0;
+			State state = State::Unloaded;
+			size_t bytes = 0;
+			bool inLru = false;
+			std::list<NPCSoldierFlyweightConcrete*>::iterator lruPosition;
+		};
+
+		// most recently released at the front
+		void makeEvictable(NPCSoldierFlyweightConcrete* _flyweight, Entry& _entry)
+		{
+			lru.push_front(_flyweight);
+			_entry.lruPosition = lru.begin();
+			_entry.inLru = true;
+		}
+
+		void loaderLoop()
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			for (;;)
+			{
+				queueReady.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (stopping)
+					return;
+
+				NPCSoldierFlyweightConcrete* flyweight = queue.front();
+				queue.pop_front();
+				lock.unlock();
+
+				bool loaded = loader(*flyweight);
+
+				lock.lock();
+				completed.emplace_back(flyweight, loaded);
+			}
+		}
+
+		FlyweightStreamerConfig config;
+		Loader loader;
+		NPCSoldierFlyweightConcrete placeholderFlyweight;
+
+		// bookkeeping, only held for short moments, never across I/O
+		mutable std::mutex stateMutex;
+		std::unordered_map<NPCSoldierFlyweightConcrete*, Entry> entries;
+		std::list<NPCSoldierFlyweightConcrete*> lru; // resident and unused
+		size_t residentBytes = 0;
+		size_t loading = 0;
+
+		struct Counters
+		{
+			uint64_t loads = 0;
+			uint64_t failedLoads = 0;
+			uint64_t evictions = 0;
+		} counters;
+
+		std::mutex queueMutex;
+		std::condition_variable queueReady;
+		std::deque<NPCSoldierFlyweightConcrete*> queue;
+		std::vector<std::pair<NPCSoldierFlyweightConcrete*, bool>> completed;
+		bool stopping = false;
+		std::vector<std::thread> loaders;
+	};
+
+	// soldiers spawning and dying over a few hundred frames, their flyweights loaded with a few milliseconds of
+	// simulated I/O each under a budget too small for all of them: the worst frame shows spawning never waits on a load
+	inline void benchmarkFlyweightStreaming(size_t frames = 300, size_t spawnsPerFrame = 500, size_t flyweightCount = 48)
+	{
+		NPCSoldierFlyweightFactory flyweights;
+		std::vector<NPCSoldierFlyweightConcrete*> kinds;
+		for (size_t i = 0; i < flyweightCount; ++i)
+		{
+			SoldierPolicy policy = samplePolicy(i);
+			kinds.push_back(flyweights.create(&policy));
+		}
+
+		FlyweightStreamerConfig config;
+		config.memoryBudget = kinds.front()->AssetBytes() * flyweightCount / 2;
+		FlyweightStreamer streamer(config, [](NPCSoldierFlyweightConcrete& _flyweight)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(3));
+			return _flyweight.Load();
+		});
+
+		std::minstd_rand random(11);
+		std::deque<NPCSoldierFlyweightConcrete*> alive;
+		double worstFrame = 0;
+		size_t placeholderDraws = 0, draws = 0;
+
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			// the mix of kinds drifts over time, so some fall out of use and others come in
+			for (size_t i = 0; i < spawnsPerFrame; ++i)
+			{
+				NPCSoldierFlyweightConcrete* kind = kinds[(frame / 20 * 7 + random() % 16) % kinds.size()];
+				streamer.acquire(kind);
+				alive.push_back(kind);
+			}
+			while (alive.size() > spawnsPerFrame * 20)
+			{
+				streamer.release(alive.front());
+				alive.pop_front();
+			}
+			streamer.update();
+
+			for (NPCSoldierFlyweightConcrete* kind : alive)
+			{
+				++draws;
+				if (&streamer.resolve(kind) == &streamer.placeholder())
+					++placeholderDraws;
+			}
+
+			worstFrame = std::max(worstFrame, elapsed<std::milli>(start));
+		}
+
+		FlyweightStreamer::Stats stats = streamer.stats();
+		std::cout << frames << " frames, worst " << worstFrame << " ms" << std::endl;
+		std::cout << stats.loads << " loads, " << stats.evictions << " evictions, " << stats.residentBytes / 1024 << " KB resident of a "
+			<< config.memoryBudget / 1024 << " KB budget" << std::endl;
+		std::cout << 100.0 * double(placeholderDraws) / double(draws) << "% of the soldiers drawn with the placeholder" << std::endl;
+	}
+}
@@ -0,0 +1,400 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdint>
+#include "Flyweight.h"
+
+namespace flyweight_pattern
+{
+	inline Vec3 operator+(const Vec3& a, const Vec3& b) { return Vec3 { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline Vec3 operator-(const Vec3& a, const Vec3& b) { return Vec3 { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline Vec3 operator*(const Vec3& a, float s) { return Vec3 { a.x * s, a.y * s, a.z * s }; }
+	inline float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline Vec3 cross(const Vec3& a, const Vec3& b) { return Vec3 { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+	inline Vec3 normalize(const Vec3& a) { return a * (1.0f / std::sqrt(dot(a, a))); }
+
+	// the points p with dot(normal, p) + distance >= 0 are on the inside
+	struct Plane
+	{
+		Vec3 normal;
+		float distance;
+	};
+
+	// what a camera sees, as six planes facing inwards and the box around them
+	struct Frustum
+	{
+		enum Containment
+		{
+			Outside,
+			Intersecting,
+			Inside,
+		};
+
+		Plane planes[6];
+		Vec3 min, max;
+
+		static Frustum perspective(const Vec3& eye, const Vec3& forward, const Vec3& up, float fovY, float aspect, float nearDistance, float farDistance)
+		{
+			Vec3 f = normalize(forward);
+			Vec3 r = normalize(cross(f, up));
+			Vec3 u = cross(r, f);
+
+			Frustum frustum;
+			Vec3 nearCenter = eye + f * nearDistance, farCenter = eye + f * farDistance;
+			frustum.planes[0] = through(f, nearCenter);
+			frustum.planes[1] = through(f * -1, farCenter);
+
+			float slope = std::tan(fovY * 0.5f);
+			float farHeight = slope * farDistance, farWidth = farHeight * aspect;
+			float nearHeight = slope * nearDistance, nearWidth = nearHeight * aspect;
+
+			// each side contains the eye, the middle of its far edge and the direction of that edge.
+			// the normal is flipped to face the forward direction, which is inside
+			const Vec3 edges[4][2] = { { r * -farWidth, u }, { r * farWidth, u }, { u * -farHeight, r }, { u * farHeight, r } };
+			for (int i = 0; i < 4; ++i)
+			{
+				Vec3 normal = normalize(cross(farCenter + edges[i][0] - eye, edges[i][1]));
+				if (dot(normal, f) < 0)
+					normal = normal * -1;
+				frustum.planes[2 + i] = through(normal, eye);
+			}
+
+			frustum.min = frustum.max = farCenter;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				float width = corner < 4 ? nearWidth : farWidth, height = corner < 4 ? nearHeight : farHeight;
+				Vec3 point = (corner < 4 ? nearCenter : farCenter) + r * (corner & 1 ? width : -width) + u * (corner & 2 ? height : -height);
+				frustum.min = Vec3 { std::min(frustum.min.x, point.x), std::min(frustum.min.y, point.y), std::min(frustum.min.z, point.z) };
+				frustum.max = Vec3 { std::max(frustum.max.x, point.x), std::max(frustum.max.y, point.y), std::max(frustum.max.z, point.z) };
+			}
+			return frustum;
+		}
+
+		bool intersects(const Vec3& center, float radius) const
+		{
+			for (const Plane& plane : planes)
+				if (dot(plane.normal, center) + plane.distance < -radius)
+					return false;
+			return true;
+		}
+
+		// the box against every plane through its corner furthest along the normal, and the nearest one
+		Containment classify(const Vec3& boxMin, const Vec3& boxMax) const
+		{
+			Containment result = Inside;
+			for (const Plane& plane : planes)
+			{
+				Vec3 furthest { plane.normal.x >= 0 ? boxMax.x : boxMin.x, plane.normal.y >= 0 ? boxMax.y : boxMin.y, plane.normal.z >= 0 ? boxMax.z : boxMin.z };
+				Vec3 nearest { plane.normal.x >= 0 ? boxMin.x : boxMax.x, plane.normal.y >= 0 ? boxMin.y : boxMax.y, plane.normal.z >= 0 ? boxMin.z : boxMax.z };
+				if (dot(plane.normal, furthest) + plane.distance < 0)
+					return Outside;
+				if (dot(plane.normal, nearest) + plane.distance < 0)
+					result = Intersecting;
+			}
+			return result;
+		}
+
+	private:
+		static Plane through(const Vec3& normal, const Vec3& point) { return Plane { normal, -dot(normal, point) }; }
+	};
+
+	// soldiers sorted into square cells on the ground (x, z), for the draw and ai passes to visit only those near a
+	// point or in view. the world is unbounded: cells are hashed into a fixed number of buckets, so cells far apart may
+	// share one and every query checks the cell of what it finds. a soldier moving within its cell costs a store,
+	// one changing cells a swap remove and a push. positions live in the buckets, so queries read memory in a row.
+	// soldiers are known by a dense id the caller picks, such as their index in SoldierTransforms
+	class SoldierGrid
+	{
+	public:
+		static const uint32_t None = UINT32_MAX;
+
+		explicit SoldierGrid(float _cellSize = 16, size_t _bucketCount = 1 << 16, float _soldierRadius = 1)
+			: cellSize(_cellSize)
+			, inverseCellSize(1 / _cellSize)
+			, soldierRadius(_soldierRadius)
+			, buckets(roundUp(_bucketCount))
+			, mask(buckets.size() - 1)
+		{}
+
+		void insert(uint32_t _id, const Vec3& _position)
+		{
+			if (_id >= entries.size())
+				entries.resize(_id + 1);
+			Entry& entry = entries[_id];
+			if (entry.bucket != None)
+			{
+				move(_id, _position);
+				return;
+			}
+
+			link(_id, bucketOf(cellX(_position.x), cellZ(_position.z)), _position);
+			widenHeights(_position.y);
+			++count;
+		}
+
+		void remove(uint32_t _id)
+		{
+			if (!contains(_id))
+				return;
+			unlink(_id);
+			entries[_id].bucket = None;
+			--count;
+		}
+
+		void move(uint32_t _id, const Vec3& _position)
+		{
+			Entry& entry = entries[_id];
+			widenHeights(_position.y);
+
+			uint32_t bucket = bucketOf(cellX(_position.x), cellZ(_position.z));
+			if (bucket == entry.bucket)
+			{
+				buckets[bucket][entry.index].position = _position;
+				return;
+			}
+			unlink(_id);
+			link(_id, bucket, _position);
+			++cellChanges;
+		}
+
+		// moves soldiers 0 .. count-1 to the positions in the arrays, like SoldierTransforms::world(r, 3) gives them
+		void moveAll(const float* _x, const float* _y, const float* _z, size_t _count)
+		{
+			for (uint32_t id = 0; id < _count; ++id)
+			{
+				if (id >= entries.size() || entries[id].bucket == None)
+					insert(id, Vec3 { _x[id], _y[id], _z[id] });
+				else
+					move(id, Vec3 { _x[id], _y[id], _z[id] });
+			}
+		}
+
+		bool contains(uint32_t _id) const { return _id < entries.size() && entries[_id].bucket != None; }
+		const Vec3& position(uint32_t _id) const { return buckets[entries[_id].bucket][entries[_id].index].position; }
+		size_t size() const { return count; }
+
+		// soldiers that changed cells since the last call
+		size_t takeCellChanges()
+		{
+			size_t changes = cellChanges;
+			cellChanges = 0;
+			return changes;
+		}
+
+		// f(id) for every soldier within radius of center on the ground, the height left out
+		template <class F>
+		void forEachInRadius(const Vec3& _center, float _radius, F&& f) const
+		{
+			float radiusSquared = _radius * _radius;
+			int x0 = cellX(_center.x - _radius), x1 = cellX(_center.x + _radius);
+			int z0 = cellZ(_center.z - _radius), z1 = cellZ(_center.z + _radius);
+			for (int z = z0; z <= z1; ++z)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					for (const Item& item : buckets[bucketOf(x, z)])
+					{
+						const Vec3& p = item.position;
+						float dx = p.x - _center.x, dz = p.z - _center.z;
+						if (dx * dx + dz * dz <= radiusSquared && cellX(p.x) == x && cellZ(p.z) == z)
+							f(item.id);
+					}
+				}
+			}
+		}
+
+		// f(id) for every soldier whose bounding sphere the frustum touches. cells entirely in view skip the per soldier test
+		template <class F>
+		void forEachInFrustum(const Frustum& _frustum, F&& f) const
+		{
+			if (count == 0)
+				return;
+			float pad = soldierRadius;
+			int x0 = cellX(_frustum.min.x - pad), x1 = cellX(_frustum.max.x + pad);
+			int z0 = cellZ(_frustum.min.z - pad), z1 = cellZ(_frustum.max.z + pad);
+			for (int z = z0; z <= z1; ++z)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					const std::vector<Item>& bucket = buckets[bucketOf(x, z)];
+					if (bucket.empty())
+						continue;
+
+					Vec3 boxMin { x * cellSize - pad, minY - pad, z * cellSize - pad };
+					Vec3 boxMax { (x + 1) * cellSize + pad, maxY + pad, (z + 1) * cellSize + pad };
+					Frustum::Containment containment = _frustum.classify(boxMin, boxMax);
+					if (containment == Frustum::Outside)
+						continue;
+
+					for (const Item& item : bucket)
+					{
+						const Vec3& p = item.position;
+						if (cellX(p.x) != x || cellZ(p.z) != z)
+							continue;
+						if (containment == Frustum::Inside || _frustum.intersects(p, soldierRadius))
+							f(item.id);
+					}
+				}
+			}
+		}
+
+	private:
+		struct Item
+		{
+			Vec3 position;
+			uint32_t id;
+		};
+
+		// where a soldier is in the buckets
+		struct Entry
+		{
+			uint32_t bucket = None;
+			uint32_t index = 0;
+		};
+
+		static size_t roundUp(size_t count)
+		{
+			size_t rounded = 16;
+			while (rounded < count)
+				rounded *= 2;
+			return rounded;
+		}
+
+		int cellX(float x) const { return floorToInt(x * inverseCellSize); }
+		int cellZ(float z) const { return floorToInt(z * inverseCellSize); }
+
+		// std::floor is a library call without sse4.1, and this runs for every soldier on every query and move
+		static int floorToInt(float v)
+		{
+			int truncated = static_cast<int>(v);
+			return truncated - (v < static_cast<float>(truncated) ? 1 : 0);
+		}
+
+		uint32_t bucketOf(int x, int z) const
+		{
+			uint32_t hash = static_cast<uint32_t>(x) * 0x9e3779b1u ^ static_cast<uint32_t>(z) * 0x85ebca77u;
+			return static_cast<uint32_t>((hash ^ hash >> 15) & mask);
+		}
+
+		void link(uint32_t id, uint32_t bucket, const Vec3& position)
+		{
+			entries[id].bucket = bucket;
+			entries[id].index = static_cast<uint32_t>(buckets[bucket].size());
+			buckets[bucket].push_back(Item { position, id });
+		}
+
+		void unlink(uint32_t id)
+		{
+			std::vector<Item>& bucket = buckets[entries[id].bucket];
+			uint32_t index = entries[id].index;
+			bucket[index] = bucket.back();
+			entries[bucket[index].id].index = index;
+			bucket.pop_back();
+		}
+
+		// the cells' boxes span every height seen, the range only ever widens
+		void widenHeights(float y)
+		{
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+		}
+
+		float cellSize;
+		float inverseCellSize;
+		float soldierRadius;
+		std::vector<std::vector<Item>> buckets;
+		size_t mask;
+		std::vector<Entry> entries;
+		size_t count = 0;
+		size_t cellChanges = 0;
+		float minY = 0, maxY = 0;
+	};
+
+	// soldierCount soldiers over a square world: moving all of them a frame's worth, radius queries for the ai and
+	// a camera's view against going through every soldier
+	inline void benchmarkSoldierGrid(size_t soldierCount = 1000000, float worldSize = 4000)
+	{
+		std::minstd_rand random(3);
+		std::uniform_real_distribution<float> spread(0, worldSize), speed(-3, 3);
+		std::vector<float> x(soldierCount), y(soldierCount, 0), z(soldierCount), vx(soldierCount), vz(soldierCount);
+		for (size_t i = 0; i < soldierCount; ++i)
+		{
+			x[i] = spread(random);
+			z[i] = spread(random);
+			vx[i] = speed(random);
+			vz[i] = speed(random);
+		}
+
+		SoldierGrid grid;
+		auto start = std::chrono::steady_clock::now();
+		grid.moveAll(x.data(), y.data(), z.data(), soldierCount);
+		double build = elapsed<std::milli>(start);
+		grid.takeCellChanges();
+
+		const float dt = 1.0f / 60;
+		const int frames = 10;
+		start = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			for (size_t i = 0; i < soldierCount; ++i)
+			{
+				x[i] += vx[i] * dt;
+				z[i] += vz[i] * dt;
+			}
+			grid.moveAll(x.data(), y.data(), z.data(), soldierCount);
+		}
+		double update = elapsed<std::milli>(start) / frames;
+		size_t changes = grid.takeCellChanges() / frames;
+
+		// ai: who is near each of a thousand soldiers
+		const size_t queries = 1000;
+		const float radius = 30;
+		const size_t scans = queries / 100;
+		size_t found = 0, foundInScanned = 0, foundByScan = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < queries; ++q)
+		{
+			if (q == scans)
+				foundInScanned = found;
+			grid.forEachInRadius(grid.position(uint32_t(q * 997 % soldierCount)), radius, [&found](uint32_t) { ++found; });
+		}
+		double radiusQueries = elapsed<std::milli>(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < scans; ++q)
+		{
+			const Vec3& center = grid.position(uint32_t(q * 997 % soldierCount));
+			for (size_t i = 0; i < soldierCount; ++i)
+			{
+				float dx = x[i] - center.x, dz = z[i] - center.z;
+				if (dx * dx + dz * dz <= radius * radius)
+					++foundByScan;
+			}
+		}
+		double radiusScan = elapsed<std::milli>(start) / scans;
+
+		// draw: a camera on the ground in a corner looking into the world
+		Frustum view = Frustum::perspective(Vec3 { 0, 2, 0 }, Vec3 { 1, 0, 1 }, Vec3 { 0, 1, 0 }, 1.0f, 16.0f / 9.0f, 0.5f, 600);
+		size_t visible = 0, visibleByScan = 0;
+		start = std::chrono::steady_clock::now();
+		grid.forEachInFrustum(view, [&visible](uint32_t) { ++visible; });
+		double frustumQuery = elapsed<std::milli>(start);
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < soldierCount; ++i)
+			if (view.intersects(Vec3 { x[i], y[i], z[i] }, 1))
+				++visibleByScan;
+		double frustumScan = elapsed<std::milli>(start);
+
+		std::cout << soldierCount << " soldiers, built in " << build << " ms" << std::endl;
+		std::cout << "update       : " << update << " ms per frame, " << changes << " cell changes per frame" << std::endl;
+		std::cout << "radius query : " << radiusQueries * 1000 / queries << " us each (" << found / queries << " found), scanning everyone "
+			<< radiusScan * 1000 << " us" << (foundInScanned == foundByScan ? "" : " (different!)") << std::endl;
+		std::cout << "frustum query: " << frustumQuery << " ms (" << visible << " visible), scanning everyone " << frustumScan << " ms"
+			<< (visible == visibleByScan ? "" : " (different!)") << std::endl;
+	}
+}
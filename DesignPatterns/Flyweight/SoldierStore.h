@@ -0,0 +1,271 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdint>
+#include "Flyweight.h"
+#include "SoldierTransforms.h"
+
+namespace flyweight_pattern
+{
+	// soldiers stored array by array instead of object by object, in one bucket per flyweight.
+	// a bucket keeps the extrinsic states of its soldiers contiguous, so drawing is one DrawInstanced per flyweight.
+	// positions and rotations are the component arrays of a SoldierTransforms, update() runs its kernels on them in place.
+	// removal moves the bucket's last soldier into the hole, handles stay valid through it by pointing at a slot that
+	// is told where its soldier went. a handle of a removed soldier is recognized by its generation
+	class SoldierStore
+	{
+	public:
+		struct Handle
+		{
+			uint32_t slot;
+			uint32_t generation;
+		};
+
+		Handle add(const ExtrinsicState_Soldier& _state, NPCSoldierFlyweightConcrete* _flyweight)
+		{
+			uint32_t bucketIndex = bucketOf(_flyweight);
+			Bucket& bucket = buckets[bucketIndex];
+
+			uint32_t slotIndex;
+			if (freeSlot != NoSlot)
+			{
+				slotIndex = freeSlot;
+				freeSlot = slots[slotIndex].nextFree;
+			}
+			else
+			{
+				slotIndex = static_cast<uint32_t>(slots.size());
+				slots.push_back(Slot());
+			}
+
+			Slot& slot = slots[slotIndex];
+			slot.bucket = bucketIndex;
+			slot.index = static_cast<uint32_t>(bucket.ids.size());
+			slot.used = true;
+
+			SoldierTransform transform {};
+			transform.position = _state.position;
+			transform.rotation = _state.rotation;
+			integrate(transform, 0); // the world matrix, nothing moves yet
+			bucket.transforms.add(transform);
+			bucket.colors.push_back(_state.color);
+			bucket.ids.push_back(_state.id);
+			bucket.names.push_back(_state.name);
+			bucket.slots.push_back(slotIndex);
+			++count;
+
+			return Handle { slotIndex, slot.generation };
+		}
+
+		bool remove(Handle _handle)
+		{
+			if (!contains(_handle))
+				return false;
+
+			Slot& slot = slots[_handle.slot];
+			Bucket& bucket = buckets[slot.bucket];
+			uint32_t index = slot.index;
+			uint32_t last = static_cast<uint32_t>(bucket.ids.size() - 1);
+
+			if (index != last)
+			{
+				bucket.colors[index] = bucket.colors[last];
+				bucket.ids[index] = bucket.ids[last];
+				bucket.names[index] = std::move(bucket.names[last]);
+				bucket.slots[index] = bucket.slots[last];
+				slots[bucket.slots[index]].index = index;
+			}
+			bucket.transforms.remove(index);
+			bucket.colors.pop_back();
+			bucket.ids.pop_back();
+			bucket.names.pop_back();
+			bucket.slots.pop_back();
+
+			++slot.generation;
+			slot.used = false;
+			slot.nextFree = freeSlot;
+			freeSlot = _handle.slot;
+			--count;
+			return true;
+		}
+
+		bool contains(Handle _handle) const
+		{
+			return _handle.slot < slots.size() && slots[_handle.slot].generation == _handle.generation
+				&& slots[_handle.slot].used;
+		}
+
+		// the handle must be valid
+		SoldierTransform transform(Handle _handle) { return at(_handle).transforms.get(slots[_handle.slot].index); }
+		void setTransform(Handle _handle, const SoldierTransform& _transform) { at(_handle).transforms.set(slots[_handle.slot].index, _transform); }
+		Position position(Handle _handle) { return transform(_handle).position; }
+		Orientation rotation(Handle _handle) { return transform(_handle).rotation; }
+		Color& color(Handle _handle) { return at(_handle).colors[slots[_handle.slot].index]; }
+		int64_t id(Handle _handle) { return at(_handle).ids[slots[_handle.slot].index]; }
+		const std::string& name(Handle _handle) { return at(_handle).names[slots[_handle.slot].index]; }
+		NPCSoldierFlyweightConcrete* flyweight(Handle _handle) { return at(_handle).flyweight; }
+
+		size_t size() const { return count; }
+		size_t bucketCount() const { return buckets.size(); }
+
+		// moves and turns every soldier by its velocities, bucket by bucket with the kernels of SoldierTransforms
+		void update(float _dt, SimdLevel _level = detectSimdLevel())
+		{
+			for (Bucket& bucket : buckets)
+				bucket.transforms.update(_dt, _level);
+		}
+
+		// everything the store holds on to, spare capacity included, the flyweights not
+		size_t ExtrinsicBytes() const
+		{
+			size_t bytes = sizeof(*this) + buckets.capacity() * sizeof(Bucket) + slots.capacity() * sizeof(Slot);
+			size_t inPlace = std::string().capacity();
+			for (const Bucket& bucket : buckets)
+			{
+				bytes += bucket.transforms.capacity() * SoldierTransforms::StreamCount * sizeof(float)
+					+ bucket.colors.capacity() * sizeof(Color) + bucket.ids.capacity() * sizeof(int64_t)
+					+ bucket.names.capacity() * sizeof(std::string) + bucket.slots.capacity() * sizeof(uint32_t);
+				for (const std::string& name : bucket.names)
+					bytes += name.capacity() > inPlace ? name.capacity() + 1 : 0;
+			}
+			// a node per flyweight and the bucket array, roughly what the usual implementations allocate
+			bytes += bucketIndices.size() * (sizeof(std::pair<const NPCSoldierFlyweightConcrete*, uint32_t>) + 2 * sizeof(void*))
+				+ bucketIndices.bucket_count() * sizeof(void*);
+			return bytes;
+		}
+
+		// f(flyweight, batch) for every flyweight with soldiers
+		template <class F>
+		void forEachBatch(F&& f) const
+		{
+			for (const Bucket& bucket : buckets)
+			{
+				if (bucket.ids.empty())
+					continue;
+				const SoldierTransforms& t = bucket.transforms;
+				f(*bucket.flyweight, SoldierBatch { bucket.ids.size(),
+					t.data(SoldierTransforms::PX), t.data(SoldierTransforms::PY), t.data(SoldierTransforms::PZ),
+					t.data(SoldierTransforms::QX), t.data(SoldierTransforms::QY), t.data(SoldierTransforms::QZ), t.data(SoldierTransforms::QW),
+					bucket.colors.data(), bucket.ids.data() });
+			}
+		}
+
+		// one draw call per flyweight, returns how many were made
+		size_t draw() const
+		{
+			size_t calls = 0;
+			forEachBatch([&calls](const NPCSoldierFlyweightConcrete& flyweight, const SoldierBatch& batch)
+			{
+				flyweight.DrawInstanced(batch);
+				++calls;
+			});
+			return calls;
+		}
+
+	private:
+		static const uint32_t NoSlot = UINT32_MAX;
+
+		// where a handle's soldier currently is
+		struct Slot
+		{
+			uint32_t bucket = 0;
+			uint32_t index = 0;
+			uint32_t generation = 0;
+			uint32_t nextFree = NoSlot;
+			bool used = false;
+		};
+
+		struct Bucket
+		{
+			NPCSoldierFlyweightConcrete* flyweight;
+			SoldierTransforms transforms;
+			std::vector<Color> colors;
+			std::vector<int64_t> ids;
+			std::vector<std::string> names;	// cold, kept apart from what drawing reads
+			std::vector<uint32_t> slots;		// back to the handles, to fix them up when a soldier moves
+		};
+
+		Bucket& at(Handle _handle) { return buckets[slots[_handle.slot].bucket]; }
+
+		// buckets live as long as the store, a flyweight keeps its bucket index even while it has no soldiers
+		uint32_t bucketOf(NPCSoldierFlyweightConcrete* _flyweight)
+		{
+			auto found = bucketIndices.find(_flyweight);
+			if (found != bucketIndices.end())
+				return found->second;
+
+			uint32_t index = static_cast<uint32_t>(buckets.size());
+			buckets.push_back(Bucket());
+			buckets.back().flyweight = _flyweight;
+			bucketIndices.emplace(_flyweight, index);
+			return index;
+		}
+
+		std::vector<Bucket> buckets;
+		std::unordered_map<const NPCSoldierFlyweightConcrete*, uint32_t> bucketIndices;
+		std::vector<Slot> slots;
+		uint32_t freeSlot = NoSlot;
+		size_t count = 0;
+	};
+
+	// drawing soldiers one object at a time through the soldiers vector against a SoldierStore, and the cost of adding
+	// and removing soldiers in the store
+	inline void benchmarkSoldierStore(size_t soldierCount = 100000, size_t flyweightCount = 48)
+	{
+		NPCSoldierFlyweightFactory flyweights;
+		std::vector<NPCSoldierFlyweightConcrete*> kinds;
+		for (size_t i = 0; i < flyweightCount; ++i)
+		{
+			SoldierPolicy policy = samplePolicy(i);
+			kinds.push_back(flyweights.create(&policy));
+		}
+
+		std::minstd_rand random(7);
+		std::vector<std::unique_ptr<NPCSoldierUnsharedFlyweight>> objects;
+		SoldierStore store;
+		std::vector<SoldierStore::Handle> handles;
+		for (size_t i = 0; i < soldierCount; ++i)
+		{
+			ExtrinsicState_Soldier state {};
+			state.id = static_cast<int64_t>(i);
+			NPCSoldierFlyweightConcrete* kind = kinds[random() % kinds.size()];
+			objects.emplace_back(new NPCSoldierUnsharedFlyweight(state, kind));
+			handles.push_back(store.add(state, kind));
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (auto& soldier : objects)
+			soldier->Draw();
+		double perObject = elapsed<std::milli>(start);
+
+		start = std::chrono::steady_clock::now();
+		size_t calls = store.draw();
+		double batched = elapsed<std::milli>(start);
+
+		start = std::chrono::steady_clock::now();
+		store.update(1.0f / 60);
+		double moved = elapsed<std::milli>(start);
+
+		// churn: every soldier dies and respawns once
+		start = std::chrono::steady_clock::now();
+		for (auto& handle : handles)
+		{
+			NPCSoldierFlyweightConcrete* kind = store.flyweight(handle);
+			ExtrinsicState_Soldier state {};
+			state.id = store.id(handle);
+			store.remove(handle);
+			handle = store.add(state, kind);
+		}
+		double churn = elapsed<std::milli>(start);
+
+		std::cout << soldierCount << " soldiers, " << flyweightCount << " flyweights" << std::endl;
+		std::cout << "object by object : " << objects.size() << " draw calls, " << perObject << " ms" << std::endl;
+		std::cout << "soldier store    : " << calls << " draw calls, " << batched << " ms" << std::endl;
+		std::cout << "update           : " << moved << " ms, " << simdLevelName(detectSimdLevel()) << std::endl;
+		std::cout << "remove + add     : " << churn * 1e6 / double(soldierCount) << " ns per soldier" << std::endl;
+	}
+}
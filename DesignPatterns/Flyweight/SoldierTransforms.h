@@ -0,0 +1,366 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include "Flyweight.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SOLDIER_TRANSFORMS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SOLDIER_TARGET_AVX2	// msvc compiles any intrinsic anywhere, the dispatch alone keeps them off older cpus
+#else
+#define SOLDIER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace flyweight_pattern
+{
+	// rotation and translation, row by row
+	struct Matrix3x4
+	{
+		float m[3][4];
+	};
+
+	// everything moving a soldier, one soldier at a time. the reference for the batch kernels of SoldierTransforms
+	struct SoldierTransform
+	{
+		Position position;
+		Vec3 velocity;
+		Orientation rotation;
+		Vec3 angularVelocity;	// radians per second around each axis
+		Matrix3x4 world;
+	};
+
+	// moves by the velocity, turns by the angular velocity (q += dt/2 * w * q, renormalized) and builds the world matrix
+	inline void integrate(SoldierTransform& t, float dt)
+	{
+		t.position.x += t.velocity.x * dt;
+		t.position.y += t.velocity.y * dt;
+		t.position.z += t.velocity.z * dt;
+
+		Quat q = t.rotation;
+		float h = 0.5f * dt;
+		float wx = t.angularVelocity.x * h, wy = t.angularVelocity.y * h, wz = t.angularVelocity.z * h;
+		float x = q.x + (q.w * wx + wy * q.z - wz * q.y);
+		float y = q.y + (q.w * wy + wz * q.x - wx * q.z);
+		float z = q.z + (q.w * wz + wx * q.y - wy * q.x);
+		float w = q.w - (wx * q.x + wy * q.y + wz * q.z);
+		float scale = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+		x *= scale; y *= scale; z *= scale; w *= scale;
+		t.rotation = Quat { x, y, z, w };
+
+		float (&m)[3][4] = t.world.m;
+		m[0][0] = 1 - 2 * (y * y + z * z); m[0][1] = 2 * (x * y - z * w); m[0][2] = 2 * (x * z + y * w); m[0][3] = t.position.x;
+		m[1][0] = 2 * (x * y + z * w); m[1][1] = 1 - 2 * (x * x + z * z); m[1][2] = 2 * (y * z - x * w); m[1][3] = t.position.y;
+		m[2][0] = 2 * (x * z - y * w); m[2][1] = 2 * (y * z + x * w); m[2][2] = 1 - 2 * (x * x + y * y); m[2][3] = t.position.z;
+	}
+
+	enum class SimdLevel
+	{
+		Scalar,
+		SSE,
+		AVX2,
+	};
+
+	// the best the cpu running us supports, asked once
+	inline SimdLevel detectSimdLevel()
+	{
+		static const SimdLevel level = []
+		{
+#if defined(SOLDIER_TRANSFORMS_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] >= 7)
+			{
+				__cpuid(info, 1);
+				bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+				__cpuidex(info, 7, 0);
+				if (osSavesYmm && (info[1] & (1 << 5)))
+					return SimdLevel::AVX2;
+			}
+			return SimdLevel::SSE;
+#elif defined(SOLDIER_TRANSFORMS_X86)
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return SimdLevel::AVX2;
+			return __builtin_cpu_supports("sse2") ? SimdLevel::SSE : SimdLevel::Scalar;
+#else
+			return SimdLevel::Scalar;
+#endif
+		}();
+		return level;
+	}
+
+	inline const char* simdLevelName(SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::AVX2: return "avx2";
+		case SimdLevel::SSE: return "sse";
+		default: return "scalar";
+		}
+	}
+
+	// the transforms of many soldiers, one array per component, so the kernels go through 4 (sse) or 8 (avx2)
+	// soldiers per instruction. removal moves the last soldier into the hole, like SoldierStore
+	class SoldierTransforms
+	{
+	public:
+		enum Stream
+		{
+			PX, PY, PZ, VX, VY, VZ, QX, QY, QZ, QW, WX, WY, WZ,
+			InputCount,
+			M00 = InputCount, M01, M02, M03, M10, M11, M12, M13, M20, M21, M22, M23,
+			StreamCount
+		};
+
+		size_t add(const SoldierTransform& _transform)
+		{
+			const float values[] = { _transform.position.x, _transform.position.y, _transform.position.z,
+				_transform.velocity.x, _transform.velocity.y, _transform.velocity.z,
+				_transform.rotation.x, _transform.rotation.y, _transform.rotation.z, _transform.rotation.w,
+				_transform.angularVelocity.x, _transform.angularVelocity.y, _transform.angularVelocity.z };
+			for (int i = 0; i < InputCount; ++i)
+				streams[i].push_back(values[i]);
+			for (int i = 0; i < 12; ++i)
+				streams[InputCount + i].push_back(_transform.world.m[i / 4][i % 4]);
+			return count++;
+		}
+
+		void remove(size_t _index)
+		{
+			for (auto& stream : streams)
+			{
+				stream[_index] = stream.back();
+				stream.pop_back();
+			}
+			--count;
+		}
+
+		SoldierTransform get(size_t _index) const
+		{
+			SoldierTransform t;
+			float* values[] = { &t.position.x, &t.position.y, &t.position.z, &t.velocity.x, &t.velocity.y, &t.velocity.z,
+				&t.rotation.x, &t.rotation.y, &t.rotation.z, &t.rotation.w, &t.angularVelocity.x, &t.angularVelocity.y, &t.angularVelocity.z };
+			for (int i = 0; i < InputCount; ++i)
+				*values[i] = streams[i][_index];
+			for (int i = 0; i < 12; ++i)
+				t.world.m[i / 4][i % 4] = streams[InputCount + i][_index];
+			return t;
+		}
+
+		void set(size_t _index, const SoldierTransform& _transform)
+		{
+			const SoldierTransform& t = _transform;
+			const float values[] = { t.position.x, t.position.y, t.position.z, t.velocity.x, t.velocity.y, t.velocity.z,
+				t.rotation.x, t.rotation.y, t.rotation.z, t.rotation.w, t.angularVelocity.x, t.angularVelocity.y, t.angularVelocity.z };
+			for (int i = 0; i < InputCount; ++i)
+				streams[i][_index] = values[i];
+			for (int i = 0; i < 12; ++i)
+				streams[InputCount + i][_index] = t.world.m[i / 4][i % 4];
+		}
+
+		size_t size() const { return count; }
+		size_t capacity() const { return streams[0].capacity(); }	// every stream grows in step
+
+		// one component of every soldier
+		const float* data(Stream _stream) const { return streams[_stream].data(); }
+
+		// world matrix element (row, column) of every soldier, what an instanced draw reads
+		const float* world(int _row, int _column) const { return streams[InputCount + _row * 4 + _column].data(); }
+
+		// integrate() for every soldier, with the widest kernel the cpu has unless told otherwise
+		void update(float _dt, SimdLevel _level = detectSimdLevel())
+		{
+			float* s[StreamCount];
+			for (int i = 0; i < StreamCount; ++i)
+				s[i] = streams[i].data();
+
+			size_t done = 0;
+#if defined(SOLDIER_TRANSFORMS_X86)
+			if (_level == SimdLevel::AVX2)
+				done = updateAVX2(s, count, _dt);
+			else if (_level == SimdLevel::SSE)
+				done = updateSSE(s, count, _dt);
+#endif
+			updateScalar(s, done, count, _dt); // what's left over after the last full vector
+		}
+
+	private:
+		static void updateScalar(float* const* s, size_t begin, size_t end, float dt)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				SoldierTransform t;
+				t.position = Vec3 { s[PX][i], s[PY][i], s[PZ][i] };
+				t.velocity = Vec3 { s[VX][i], s[VY][i], s[VZ][i] };
+				t.rotation = Quat { s[QX][i], s[QY][i], s[QZ][i], s[QW][i] };
+				t.angularVelocity = Vec3 { s[WX][i], s[WY][i], s[WZ][i] };
+				integrate(t, dt);
+
+				s[PX][i] = t.position.x; s[PY][i] = t.position.y; s[PZ][i] = t.position.z;
+				s[QX][i] = t.rotation.x; s[QY][i] = t.rotation.y; s[QZ][i] = t.rotation.z; s[QW][i] = t.rotation.w;
+				s[M00][i] = t.world.m[0][0]; s[M01][i] = t.world.m[0][1]; s[M02][i] = t.world.m[0][2]; s[M03][i] = t.world.m[0][3];
+				s[M10][i] = t.world.m[1][0]; s[M11][i] = t.world.m[1][1]; s[M12][i] = t.world.m[1][2]; s[M13][i] = t.world.m[1][3];
+				s[M20][i] = t.world.m[2][0]; s[M21][i] = t.world.m[2][1]; s[M22][i] = t.world.m[2][2]; s[M23][i] = t.world.m[2][3];
+			}
+		}
+
+#if defined(SOLDIER_TRANSFORMS_X86)
+		// the same steps as integrate(), four soldiers at a time. returns how many soldiers it did
+		static size_t updateSSE(float* const* s, size_t count, float dt)
+		{
+			const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2), step = _mm_set1_ps(dt), half = _mm_set1_ps(0.5f * dt);
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_loadu_ps(s[PX] + i), _mm_mul_ps(_mm_loadu_ps(s[VX] + i), step));
+				__m128 py = _mm_add_ps(_mm_loadu_ps(s[PY] + i), _mm_mul_ps(_mm_loadu_ps(s[VY] + i), step));
+				__m128 pz = _mm_add_ps(_mm_loadu_ps(s[PZ] + i), _mm_mul_ps(_mm_loadu_ps(s[VZ] + i), step));
+
+				__m128 qx = _mm_loadu_ps(s[QX] + i), qy = _mm_loadu_ps(s[QY] + i), qz = _mm_loadu_ps(s[QZ] + i), qw = _mm_loadu_ps(s[QW] + i);
+				__m128 wx = _mm_mul_ps(_mm_loadu_ps(s[WX] + i), half);
+				__m128 wy = _mm_mul_ps(_mm_loadu_ps(s[WY] + i), half);
+				__m128 wz = _mm_mul_ps(_mm_loadu_ps(s[WZ] + i), half);
+				__m128 x = _mm_add_ps(qx, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(qw, wx), _mm_mul_ps(wy, qz)), _mm_mul_ps(wz, qy)));
+				__m128 y = _mm_add_ps(qy, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(qw, wy), _mm_mul_ps(wz, qx)), _mm_mul_ps(wx, qz)));
+				__m128 z = _mm_add_ps(qz, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(qw, wz), _mm_mul_ps(wx, qy)), _mm_mul_ps(wy, qx)));
+				__m128 w = _mm_sub_ps(qw, _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, qx), _mm_mul_ps(wy, qy)), _mm_mul_ps(wz, qz)));
+				__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+				__m128 scale = _mm_div_ps(one, length);
+				x = _mm_mul_ps(x, scale); y = _mm_mul_ps(y, scale); z = _mm_mul_ps(z, scale); w = _mm_mul_ps(w, scale);
+
+				_mm_storeu_ps(s[PX] + i, px); _mm_storeu_ps(s[PY] + i, py); _mm_storeu_ps(s[PZ] + i, pz);
+				_mm_storeu_ps(s[QX] + i, x); _mm_storeu_ps(s[QY] + i, y); _mm_storeu_ps(s[QZ] + i, z); _mm_storeu_ps(s[QW] + i, w);
+
+				__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+				__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+				__m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w), zw = _mm_mul_ps(z, w);
+				_mm_storeu_ps(s[M00] + i, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+				_mm_storeu_ps(s[M01] + i, _mm_mul_ps(two, _mm_sub_ps(xy, zw)));
+				_mm_storeu_ps(s[M02] + i, _mm_mul_ps(two, _mm_add_ps(xz, yw)));
+				_mm_storeu_ps(s[M03] + i, px);
+				_mm_storeu_ps(s[M10] + i, _mm_mul_ps(two, _mm_add_ps(xy, zw)));
+				_mm_storeu_ps(s[M11] + i, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+				_mm_storeu_ps(s[M12] + i, _mm_mul_ps(two, _mm_sub_ps(yz, xw)));
+				_mm_storeu_ps(s[M13] + i, py);
+				_mm_storeu_ps(s[M20] + i, _mm_mul_ps(two, _mm_sub_ps(xz, yw)));
+				_mm_storeu_ps(s[M21] + i, _mm_mul_ps(two, _mm_add_ps(yz, xw)));
+				_mm_storeu_ps(s[M22] + i, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+				_mm_storeu_ps(s[M23] + i, pz);
+			}
+			return i;
+		}
+
+		// updateSSE eight soldiers at a time
+		SOLDIER_TARGET_AVX2 static size_t updateAVX2(float* const* s, size_t count, float dt)
+		{
+			const __m256 one = _mm256_set1_ps(1), two = _mm256_set1_ps(2), step = _mm256_set1_ps(dt), half = _mm256_set1_ps(0.5f * dt);
+			size_t i = 0;
+			for (; i + 8 <= count; i += 8)
+			{
+				__m256 px = _mm256_add_ps(_mm256_loadu_ps(s[PX] + i), _mm256_mul_ps(_mm256_loadu_ps(s[VX] + i), step));
+				__m256 py = _mm256_add_ps(_mm256_loadu_ps(s[PY] + i), _mm256_mul_ps(_mm256_loadu_ps(s[VY] + i), step));
+				__m256 pz = _mm256_add_ps(_mm256_loadu_ps(s[PZ] + i), _mm256_mul_ps(_mm256_loadu_ps(s[VZ] + i), step));
+
+				__m256 qx = _mm256_loadu_ps(s[QX] + i), qy = _mm256_loadu_ps(s[QY] + i), qz = _mm256_loadu_ps(s[QZ] + i), qw = _mm256_loadu_ps(s[QW] + i);
+				__m256 wx = _mm256_mul_ps(_mm256_loadu_ps(s[WX] + i), half);
+				__m256 wy = _mm256_mul_ps(_mm256_loadu_ps(s[WY] + i), half);
+				__m256 wz = _mm256_mul_ps(_mm256_loadu_ps(s[WZ] + i), half);
+				__m256 x = _mm256_add_ps(qx, _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(qw, wx), _mm256_mul_ps(wy, qz)), _mm256_mul_ps(wz, qy)));
+				__m256 y = _mm256_add_ps(qy, _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(qw, wy), _mm256_mul_ps(wz, qx)), _mm256_mul_ps(wx, qz)));
+				__m256 z = _mm256_add_ps(qz, _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(qw, wz), _mm256_mul_ps(wx, qy)), _mm256_mul_ps(wy, qx)));
+				__m256 w = _mm256_sub_ps(qw, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, qx), _mm256_mul_ps(wy, qy)), _mm256_mul_ps(wz, qz)));
+				__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_add_ps(_mm256_mul_ps(z, z), _mm256_mul_ps(w, w))));
+				__m256 scale = _mm256_div_ps(one, length);
+				x = _mm256_mul_ps(x, scale); y = _mm256_mul_ps(y, scale); z = _mm256_mul_ps(z, scale); w = _mm256_mul_ps(w, scale);
+
+				_mm256_storeu_ps(s[PX] + i, px); _mm256_storeu_ps(s[PY] + i, py); _mm256_storeu_ps(s[PZ] + i, pz);
+				_mm256_storeu_ps(s[QX] + i, x); _mm256_storeu_ps(s[QY] + i, y); _mm256_storeu_ps(s[QZ] + i, z); _mm256_storeu_ps(s[QW] + i, w);
+
+				__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+				__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+				__m256 xw = _mm256_mul_ps(x, w), yw = _mm256_mul_ps(y, w), zw = _mm256_mul_ps(z, w);
+				_mm256_storeu_ps(s[M00] + i, _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))));
+				_mm256_storeu_ps(s[M01] + i, _mm256_mul_ps(two, _mm256_sub_ps(xy, zw)));
+				_mm256_storeu_ps(s[M02] + i, _mm256_mul_ps(two, _mm256_add_ps(xz, yw)));
+				_mm256_storeu_ps(s[M03] + i, px);
+				_mm256_storeu_ps(s[M10] + i, _mm256_mul_ps(two, _mm256_add_ps(xy, zw)));
+				_mm256_storeu_ps(s[M11] + i, _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))));
+				_mm256_storeu_ps(s[M12] + i, _mm256_mul_ps(two, _mm256_sub_ps(yz, xw)));
+				_mm256_storeu_ps(s[M13] + i, py);
+				_mm256_storeu_ps(s[M20] + i, _mm256_mul_ps(two, _mm256_sub_ps(xz, yw)));
+				_mm256_storeu_ps(s[M21] + i, _mm256_mul_ps(two, _mm256_add_ps(yz, xw)));
+				_mm256_storeu_ps(s[M22] + i, _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))));
+				_mm256_storeu_ps(s[M23] + i, pz);
+			}
+			return i;
+		}
+#endif
+
+		std::vector<float> streams[StreamCount];
+		size_t count = 0;
+	};
+
+	// a frame of movement for soldierCount soldiers: the transform structs one by one against every kernel of
+	// SoldierTransforms the cpu can run
+	inline void benchmarkSoldierTransforms(size_t soldierCount = 100000, size_t frames = 100)
+	{
+		std::minstd_rand random(5);
+		std::uniform_real_distribution<float> spread(-50, 50), speed(-2, 2);
+
+		std::vector<SoldierTransform> objects;
+		SoldierTransforms arrays;
+		for (size_t i = 0; i < soldierCount; ++i)
+		{
+			SoldierTransform t {};
+			t.position = Vec3 { spread(random), 0, spread(random) };
+			t.velocity = Vec3 { speed(random), 0, speed(random) };
+			t.rotation = Quat {};
+			t.angularVelocity = Vec3 { 0, speed(random), 0 };
+			objects.push_back(t);
+			arrays.add(t);
+		}
+
+		const float dt = 1.0f / 60;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < frames; ++frame)
+			for (SoldierTransform& t : objects)
+				integrate(t, dt);
+		std::cout << soldierCount << " soldiers, " << frames << " frames" << std::endl;
+		std::cout << "one by one : " << elapsed<std::nano>(start) / double(soldierCount * frames) << " ns per soldier per frame" << std::endl;
+
+		const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE, SimdLevel::AVX2 };
+		for (SimdLevel level : levels)
+		{
+			if (level > detectSimdLevel())
+				break;
+
+			SoldierTransforms copy = arrays;
+			start = std::chrono::steady_clock::now();
+			for (size_t frame = 0; frame < frames; ++frame)
+				copy.update(dt, level);
+			double time = elapsed<std::nano>(start) / double(soldierCount * frames);
+
+			// every kernel has to end up where the one by one update did
+			float worst = 0;
+			for (size_t i = 0; i < soldierCount; ++i)
+			{
+				SoldierTransform t = copy.get(i);
+				for (int row = 0; row < 3; ++row)
+					for (int column = 0; column < 4; ++column)
+						worst = std::max(worst, std::fabs(t.world.m[row][column] - objects[i].world.m[row][column]));
+			}
+
+			std::cout << "arrays " << simdLevelName(level) << std::string(6 - std::string(simdLevelName(level)).size(), ' ') << ": "
+				<< time << " ns per soldier per frame, off by " << worst << std::endl;
+		}
+	}
+}
@@ -0,0 +1,633 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include "ProxyPattern.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PROXY_PATTERN_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <cerrno>
+#endif
+#endif
+
+namespace proxy_pattern
+{
+	// result is the number of bytes transferred or a negative errno
+	using AsyncCallback = std::function<void(int64_t result)>;
+
+	struct AsyncFileConfig
+	{
+		unsigned queueDepth = 128;		// operations in flight before a submit is forced
+		bool preferIoUring = true;		// fall back to the thread pool when io_uring isn't available
+		unsigned workerThreads = 4;		// thread pool backend only
+	};
+
+	// the machinery behind AsyncFile. operations are queued by prepare*, handed over to the kernel (or workers)
+	// all at once by submit, and their callbacks run on the thread calling reap
+	class AsyncIOBackend
+	{
+	public:
+		virtual ~AsyncIOBackend() {}
+
+		virtual const char* name() const = 0;
+
+		// buffers registered up front skip the per-operation page pinning of the kernel, used through their index
+		virtual bool registerBuffers(const std::vector<std::pair<char*, size_t>>& buffers) = 0;
+
+		// fixedBuffer is the index of a registered buffer containing [buffer, buffer + size) or -1
+		virtual void prepareRead(int fd, size_t offset, char* buffer, size_t size, int fixedBuffer, AsyncCallback callback) = 0;
+		virtual void prepareWrite(int fd, size_t offset, const char* buffer, size_t size, int fixedBuffer, AsyncCallback callback) = 0;
+
+		// returns the number of operations handed over
+		virtual size_t submit() = 0;
+
+		// runs the callbacks of finished operations, blocks until at least minCompletions of them are done
+		virtual size_t reap(size_t minCompletions) = 0;
+
+		virtual size_t inFlight() const = 0;
+	};
+
+	class ThreadPoolAsyncBackend : public AsyncIOBackend
+	{
+	public:
+		ThreadPoolAsyncBackend(unsigned _queueDepth, unsigned _workers)
+			: queueDepth(_queueDepth ? _queueDepth : 1)
+		{
+			for (unsigned i = 0; i < (_workers ? _workers : 1); ++i)
+				workers.emplace_back([this] { work(); });
+		}
+
+		~ThreadPoolAsyncBackend() override
+		{
+			submit();
+			while (inFlight())
+				reap(1);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			workAvailable.notify_all();
+			for (auto& worker : workers)
+				worker.join();
+		}
+
+		const char* name() const override { return "thread pool"; }
+
+		bool registerBuffers(const std::vector<std::pair<char*, size_t>>&) override { return true; }
+
+		void prepareRead(int fd, size_t offset, char* buffer, size_t size, int, AsyncCallback callback) override
+		{
+			prepare(Operation { fd, offset, buffer, size, false, std::move(callback), 0 });
+		}
+
+		void prepareWrite(int fd, size_t offset, const char* buffer, size_t size, int, AsyncCallback callback) override
+		{
+			prepare(Operation { fd, offset, const_cast<char*>(buffer), size, true, std::move(callback), 0 });
+		}
+
+		size_t submit() override
+		{
+			if (prepared.empty())
+				return 0;
+
+			size_t count = prepared.size();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (auto& op : prepared)
+					queued.push_back(std::move(op));
+				pending += count;
+			}
+			prepared.clear();
+			workAvailable.notify_all();
+			return count;
+		}
+
+		size_t reap(size_t minCompletions) override
+		{
+			std::deque<Operation> done;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				minCompletions = std::min(minCompletions, pending);
+				workDone.wait(lock, [this, minCompletions] { return completed.size() >= minCompletions; });
+				done.swap(completed);
+				pending -= done.size();
+			}
+
+			for (auto& op : done)
+			{
+				if (op.callback)
+					op.callback(op.result);
+			}
+			return done.size();
+		}
+
+		size_t inFlight() const override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return pending + prepared.size();
+		}
+
+	private:
+		struct Operation
+		{
+			int fd;
+			size_t offset;
+			char* buffer;
+			size_t size;
+			bool write;
+			AsyncCallback callback;
+			int64_t result;
+		};
+
+		void prepare(Operation&& op)
+		{
+			if (prepared.size() >= queueDepth)
+				submit();
+			prepared.push_back(std::move(op));
+		}
+
+		void work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;)
+			{
+				workAvailable.wait(lock, [this] { return stopping || !queued.empty(); });
+				if (queued.empty())
+					return;
+
+				Operation op = std::move(queued.front());
+				queued.pop_front();
+				lock.unlock();
+
+				op.result = op.write
+					? native::writeAt(op.fd, static_cast<int64_t>(op.offset), op.buffer, op.size)
+					: native::readAt(op.fd, static_cast<int64_t>(op.offset), op.buffer, op.size);
+
+				lock.lock();
+				completed.push_back(std::move(op));
+				workDone.notify_one();
+			}
+		}
+
+		size_t queueDepth;
+		std::vector<Operation> prepared;	// owner thread only
+
+		mutable std::mutex mutex;
+		std::condition_variable workAvailable;
+		std::condition_variable workDone;
+		std::deque<Operation> queued;
+		std::deque<Operation> completed;
+		size_t pending = 0;					// submitted but not reaped
+		bool stopping = false;
+
+		std::vector<std::thread> workers;
+	};
+
+#if defined(PROXY_PATTERN_HAS_IO_URING)
+	// io_uring driven through the raw syscalls: a whole batch of reads goes to the kernel with a single io_uring_enter
+	class IoUringAsyncBackend : public AsyncIOBackend
+	{
+	public:
+		explicit IoUringAsyncBackend(unsigned _queueDepth)
+		{
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+
+			ring = static_cast<int>(syscall(__NR_io_uring_setup, _queueDepth ? _queueDepth : 1, &params));
+			if (ring < 0)
+				return;
+
+			size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (singleMap)
+				sqSize = cqSize = std::max(sqSize, cqSize);
+			sqMapSize = sqSize;
+			cqMapSize = cqSize;
+			sqeCount = params.sq_entries;
+
+			sqMap = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+			cqMap = singleMap ? sqMap : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+			sqes = static_cast<io_uring_sqe*>(mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES));
+			if (sqMap == MAP_FAILED || cqMap == MAP_FAILED || sqes == MAP_FAILED)
+			{
+				unmap();
+				return;
+			}
+
+			char* sq = static_cast<char*>(sqMap);
+			sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+			char* cq = static_cast<char*>(cqMap);
+			cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			// every in flight operation needs a completion slot, never have more of them than the cq can hold
+			operations.resize(std::min(params.cq_entries, 2 * params.sq_entries));
+			for (size_t i = 0; i < operations.size(); ++i)
+				freeOperations.push_back(static_cast<uint32_t>(operations.size() - 1 - i));
+
+			localTail = *sqTail;
+		}
+
+		~IoUringAsyncBackend() override
+		{
+			if (valid())
+			{
+				submit();
+				while (inFlight())
+					reap(1);
+			}
+			unmap();
+		}
+
+		bool valid() const { return sqes != nullptr; }
+
+		const char* name() const override { return "io_uring"; }
+
+		bool registerBuffers(const std::vector<std::pair<char*, size_t>>& buffers) override
+		{
+			std::vector<iovec> vectors;
+			for (auto& buffer : buffers)
+				vectors.push_back(iovec { buffer.first, buffer.second });
+			return syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned>(vectors.size())) == 0;
+		}
+
+		void prepareRead(int fd, size_t offset, char* buffer, size_t size, int fixedBuffer, AsyncCallback callback) override
+		{
+			prepare(fixedBuffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, offset, buffer, size, fixedBuffer, std::move(callback));
+		}
+
+		void prepareWrite(int fd, size_t offset, const char* buffer, size_t size, int fixedBuffer, AsyncCallback callback) override
+		{
+			prepare(fixedBuffer >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, offset, const_cast<char*>(buffer), size, fixedBuffer, std::move(callback));
+		}
+
+		// the kernel may take fewer than were queued: short of resources (EAGAIN) or with a full completion ring
+		// (EBUSY) the rest stays queued for the next submit or reap. any other error fails the rest, their
+		// callbacks get it on the next reap
+		size_t submit() override
+		{
+			if (unsubmitted == 0)
+				return 0;
+
+			__atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+			int consumed = enter(static_cast<unsigned>(unsubmitted), 0, 0);
+			if (consumed >= 0)
+			{
+				unsubmitted -= static_cast<size_t>(consumed);
+				return static_cast<size_t>(consumed);
+			}
+			if (consumed != -EAGAIN && consumed != -EBUSY)
+				failUnsubmitted(consumed);
+			return 0;
+		}
+
+		// one completion at a time, the head goes back to the kernel before its callback runs: a callback that
+		// polls or waits itself carries on from there, and so does this call once it returns
+		size_t reap(size_t minCompletions) override
+		{
+			uint64_t start = completions;
+			for (;;)
+			{
+				if (unsubmitted)
+					submit();
+
+				unsigned head = *cqHead;
+				if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+				{
+					const io_uring_cqe& cqe = cqes[head & cqMask];
+					uint32_t id = static_cast<uint32_t>(cqe.user_data);
+					int64_t result = cqe.res;
+					__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+					complete(id, result);
+					continue;
+				}
+				if (!failed.empty())
+				{
+					Failed failure = failed.front();
+					failed.pop_front();
+					complete(failure.id, failure.error);
+					continue;
+				}
+
+				size_t reaped = static_cast<size_t>(completions - start);
+				if (reaped >= minCompletions || inFlightCount == 0)
+					return reaped;
+
+				// only what the kernel took can complete, the rest is retried above once there is room
+				size_t inKernel = inFlightCount - unsubmitted;
+				if (inKernel == 0)
+					std::this_thread::yield();
+				else
+					enter(0, static_cast<unsigned>(std::min(minCompletions - reaped, inKernel)), IORING_ENTER_GETEVENTS);
+			}
+		}
+
+		size_t inFlight() const override { return inFlightCount; }
+
+	private:
+		struct Operation
+		{
+			AsyncCallback callback;
+		};
+
+		// an operation the kernel never took
+		struct Failed
+		{
+			uint32_t id;
+			int error;
+		};
+
+		void prepare(uint8_t opcode, int fd, size_t offset, char* buffer, size_t size, int fixedBuffer, AsyncCallback&& callback)
+		{
+			// the submission ring holds what the kernel hasn't taken yet, it can't be written over
+			while (unsubmitted == sqeCount)
+			{
+				if (submit() == 0 && unsubmitted == sqeCount)
+					reap(1);
+			}
+			if (freeOperations.empty())
+				reap(1);
+
+			uint32_t id = freeOperations.back();
+			freeOperations.pop_back();
+			operations[id].callback = std::move(callback);
+			++inFlightCount;
+
+			unsigned index = localTail & sqMask;
+			io_uring_sqe& sqe = sqes[index];
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = opcode;
+			sqe.fd = fd;
+			sqe.off = offset;
+			sqe.addr = reinterpret_cast<uint64_t>(buffer);
+			sqe.len = static_cast<uint32_t>(size);
+			sqe.buf_index = static_cast<uint16_t>(fixedBuffer >= 0 ? fixedBuffer : 0);
+			sqe.user_data = id;
+
+			sqArray[index] = index;
+			++localTail;
+			++unsubmitted;
+		}
+
+		// returns the number of entries the kernel took or a negative errno
+		int enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+		{
+			for (;;)
+			{
+				long result = syscall(__NR_io_uring_enter, ring, toSubmit, minComplete, flags, nullptr, 0);
+				if (result >= 0)
+					return static_cast<int>(result);
+				if (errno != EINTR)
+					return -errno;
+			}
+		}
+
+		void complete(uint32_t id, int64_t result)
+		{
+			AsyncCallback callback = std::move(operations[id].callback);
+			freeOperations.push_back(id);
+			--inFlightCount;
+			++completions;
+			if (callback)
+				callback(result);
+		}
+
+		// takes back the entries the kernel didn't consume: without SQPOLL it only reads the ring inside enter
+		void failUnsubmitted(int error)
+		{
+			for (unsigned i = localTail - static_cast<unsigned>(unsubmitted); i != localTail; ++i)
+				failed.push_back(Failed { static_cast<uint32_t>(sqes[i & sqMask].user_data), error });
+			localTail -= static_cast<unsigned>(unsubmitted);
+			__atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+			unsubmitted = 0;
+		}
+
+		void unmap()
+		{
+			if (sqes && sqes != MAP_FAILED)
+				munmap(sqes, sqeCount * sizeof(io_uring_sqe));
+			if (cqMap && cqMap != MAP_FAILED && cqMap != sqMap)
+				munmap(cqMap, cqMapSize);
+			if (sqMap && sqMap != MAP_FAILED)
+				munmap(sqMap, sqMapSize);
+			if (ring >= 0)
+				close(ring);
+
+			sqes = nullptr;
+			sqMap = cqMap = nullptr;
+			ring = -1;
+		}
+
+		int ring = -1;
+		void* sqMap = nullptr;
+		void* cqMap = nullptr;
+		size_t sqMapSize = 0, cqMapSize = 0;
+
+		io_uring_sqe* sqes = nullptr;
+		unsigned sqeCount = 0;
+		unsigned* sqTail = nullptr;
+		unsigned* sqArray = nullptr;
+		unsigned sqMask = 0;
+		unsigned localTail = 0;
+		size_t unsubmitted = 0;				// written to the ring, not taken by the kernel yet
+
+		io_uring_cqe* cqes = nullptr;
+		unsigned* cqHead = nullptr;
+		unsigned* cqTail = nullptr;
+		unsigned cqMask = 0;
+
+		std::vector<Operation> operations;
+		std::vector<uint32_t> freeOperations;
+		std::deque<Failed> failed;
+		size_t inFlightCount = 0;
+		uint64_t completions = 0;
+	};
+#endif
+
+	inline std::unique_ptr<AsyncIOBackend> createAsyncIOBackend(const AsyncFileConfig& config)
+	{
+#if defined(PROXY_PATTERN_HAS_IO_URING)
+		if (config.preferIoUring)
+		{
+			std::unique_ptr<IoUringAsyncBackend> uring(new IoUringAsyncBackend(config.queueDepth));
+			if (uring->valid())
+				return std::unique_ptr<AsyncIOBackend>(uring.release());
+		}
+#endif
+		return std::unique_ptr<AsyncIOBackend>(new ThreadPoolAsyncBackend(config.queueDepth, config.workerThreads));
+	}
+
+	// a File with an additional asynchronous, batched interface. the synchronous IFile calls go straight to the file,
+	// readAsync/writeAsync are only queued and reach the kernel together on submit(). callbacks (and futures) are
+	// completed on the thread calling poll() or wait(). not meant to be shared across threads, one owner drives the queue
+	class AsyncFile : public IFile
+	{
+	public:
+		explicit AsyncFile(const AsyncFileConfig& config = AsyncFileConfig())
+			: backend(createAsyncIOBackend(config))
+		{}
+
+		~AsyncFile() override { close(); }
+
+		const char* backendName() const { return backend->name(); }
+
+		bool open(const char* name) override { return file.open(name); }
+		void close() override
+		{
+			if (!file.isOpen())
+				return;
+
+			backend->submit();
+			while (backend->inFlight())
+				backend->reap(1);
+			file.close();
+		}
+		size_t read(char* buffer, size_t size) override { return file.read(buffer, size); }
+		void write(char* buffer, size_t size) override { file.write(buffer, size); }
+		void seek(size_t offset) override { file.seek(offset); }
+		size_t readAt(size_t offset, char* buffer, size_t size) override { return file.readAt(offset, buffer, size); }
+		size_t writeAt(size_t offset, const char* buffer, size_t size) override { return file.writeAt(offset, buffer, size); }
+		bool sync() override
+		{
+			wait(); // the queued writes are part of what has to become durable
+			return file.sync();
+		}
+		size_t position() override { return file.position(); }
+		size_t size() const override { return file.size(); }
+		bool isOpen() const override { return file.isOpen(); }
+
+		// returns the index of each buffer in the registered set, reads and writes inside them avoid the page pinning
+		bool registerBuffers(const std::vector<std::pair<char*, size_t>>& buffers)
+		{
+			if (!backend->registerBuffers(buffers))
+				return false;
+			registered = buffers;
+			return true;
+		}
+
+		void readAsync(size_t offset, char* buffer, size_t size, AsyncCallback callback)
+		{
+			backend->prepareRead(file.nativeHandle(), offset, buffer, size, fixedBufferOf(buffer, size), std::move(callback));
+		}
+
+		void writeAsync(size_t offset, const char* buffer, size_t size, AsyncCallback callback)
+		{
+			backend->prepareWrite(file.nativeHandle(), offset, buffer, size, fixedBufferOf(buffer, size), std::move(callback));
+		}
+
+		std::future<int64_t> readAsync(size_t offset, char* buffer, size_t size)
+		{
+			auto promise = std::make_shared<std::promise<int64_t>>();
+			readAsync(offset, buffer, size, [promise](int64_t result) { promise->set_value(result); });
+			return promise->get_future();
+		}
+
+		std::future<int64_t> writeAsync(size_t offset, const char* buffer, size_t size)
+		{
+			auto promise = std::make_shared<std::promise<int64_t>>();
+			writeAsync(offset, buffer, size, [promise](int64_t result) { promise->set_value(result); });
+			return promise->get_future();
+		}
+
+		// one syscall for everything queued since the last submit
+		size_t submit() { return backend->submit(); }
+
+		// runs the callbacks of whatever has finished, without blocking
+		size_t poll() { return backend->reap(0); }
+
+		// submits and blocks until minCompletions operations have finished (all in flight ones by default)
+		size_t wait(size_t minCompletions = SIZE_MAX)
+		{
+			backend->submit();
+			return backend->reap(minCompletions);
+		}
+
+		size_t inFlight() const { return backend->inFlight(); }
+
+	private:
+		int fixedBufferOf(const char* buffer, size_t size) const
+		{
+			for (size_t i = 0; i < registered.size(); ++i)
+			{
+				const char* begin = registered[i].first;
+				if (buffer >= begin && buffer + size <= begin + registered[i].second)
+					return static_cast<int>(i);
+			}
+			return -1;
+		}
+
+		File file;
+		std::unique_ptr<AsyncIOBackend> backend;
+		std::vector<std::pair<char*, size_t>> registered;
+	};
+
+	// random block reads from a single thread, blocking readAt one by one vs batches of queueDepth async reads
+	inline void benchmarkAsyncReads(const char* path, const AsyncFileConfig& config, size_t reads, size_t blockSize)
+	{
+		AsyncFile file(config);
+		if (!file.open(path) || file.size() < blockSize)
+		{
+			std::cout << "benchmarkAsyncReads: can't use " << path << std::endl;
+			return;
+		}
+
+		size_t blocks = file.size() / blockSize;
+		std::vector<char> arena(size_t(config.queueDepth) * blockSize);
+		file.registerBuffers({ { arena.data(), arena.size() } });
+
+		std::mt19937_64 rng(42);
+		std::vector<size_t> offsets(reads);
+		for (auto& offset : offsets)
+			offset = (rng() % blocks) * blockSize;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < reads; ++i)
+			file.readAt(offsets[i], arena.data(), blockSize);
+		double blocking = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		size_t failed = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < reads; i += config.queueDepth)
+		{
+			size_t batch = std::min<size_t>(config.queueDepth, reads - i);
+			for (size_t j = 0; j < batch; ++j)
+			{
+				file.readAsync(offsets[i + j], arena.data() + j * blockSize, blockSize, [&failed, blockSize](int64_t result)
+				{
+					if (result != static_cast<int64_t>(blockSize))
+						++failed;
+				});
+			}
+			file.wait();
+		}
+		double batched = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "blocking readAt: " << double(reads) / blocking << " reads/s" << std::endl;
+		std::cout << "async (" << file.backendName() << ", qd " << config.queueDepth << "): "
+				  << double(reads) / batched << " reads/s"
+				  << (failed ? ", some reads failed" : "") << std::endl;
+	}
+}
@@ -0,0 +1,353 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "ProxyPattern.h"
+
+namespace proxy_pattern
+{
+	// bounded set of real file handles shared by any number of PooledFile proxies.
+	// handles are recycled in LRU order, a proxy whose handle got evicted reopens it transparently on the next access.
+	class FileHandlePool
+	{
+	public:
+		struct Stats
+		{
+			uint64_t opens = 0;		// first open of a logical file
+			uint64_t reopens = 0;	// open of a logical file whose handle had been evicted
+			uint64_t hits = 0;		// accesses served by a still warm handle, no syscall involved
+			uint64_t evictions = 0;
+
+			double reopenRate() const
+			{
+				uint64_t accesses = opens + reopens + hits;
+				return accesses ? double(reopens) / double(accesses) : 0.0;
+			}
+		};
+
+		explicit FileHandlePool(size_t _capacity)
+			: slots(_capacity ? _capacity : 1)
+		{
+			for (int i = 0; i < int(slots.size()); ++i)
+				pushFront(i);
+		}
+
+		size_t capacity() const { return slots.size(); }
+
+		Stats stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return counters;
+		}
+
+	private:
+		friend class PooledFile;
+
+		struct Slot
+		{
+			File file;
+			const void* owner = nullptr;
+			uint32_t generation = 0;
+			uint32_t pins = 0;		// a pinned slot is in use and can't be evicted
+			std::atomic<size_t> cursor { 0 };	// where the handle was left by the last access, set under the lock
+			int prev = -1, next = -1;
+		};
+
+		// pins the slot of _owner if it is still warm, otherwise reserves a victim slot for it.
+		// returns the slot index, _reopen is set when the caller has to (re)open the file itself
+		int acquire(const void* _owner, int _slot, uint32_t _generation, bool _everOpened, bool& _reopen, uint32_t& _newGeneration)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			if (_slot >= 0 && slots[_slot].owner == _owner && slots[_slot].generation == _generation)
+			{
+				++counters.hits;
+				++slots[_slot].pins;
+				touch(_slot);
+				_reopen = false;
+				_newGeneration = _generation;
+				return _slot;
+			}
+
+			int victim = -1;
+			available.wait(lock, [this, &victim] { return (victim = findVictim()) >= 0; });
+
+			Slot& slot = slots[victim];
+			if (slot.owner)
+				++counters.evictions;
+			if (_everOpened)
+				++counters.reopens;
+			else
+				++counters.opens;
+
+			slot.owner = _owner;
+			slot.pins = 1;
+			_newGeneration = ++slot.generation;
+			touch(victim);
+
+			_reopen = true;
+			return victim;
+		}
+
+		void release(int _slot, size_t _cursor)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots[_slot].cursor = _cursor;
+			if (--slots[_slot].pins == 0)
+				available.notify_one();
+		}
+
+		// after positional access, which may have moved the handle's cursor (windows does)
+		void release(int _slot)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots[_slot].cursor = SIZE_MAX;
+			if (--slots[_slot].pins == 0)
+				available.notify_one();
+		}
+
+		// called by the owner when it closes, or when the (re)open failed
+		void discard(const void* _owner, int _slot, uint32_t _generation)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Slot& slot = slots[_slot];
+			if (slot.owner != _owner || slot.generation != _generation)
+				return; // already handed over to somebody else
+
+			slot.owner = nullptr;
+			slot.pins = 0;
+			if (slot.file.isOpen())
+				slot.file.close();
+
+			// free slots are picked first
+			unlink(_slot);
+			pushBack(_slot);
+			available.notify_one();
+		}
+
+		int findVictim() const
+		{
+			for (int i = tail; i >= 0; i = slots[i].prev)
+			{
+				if (slots[i].pins == 0)
+					return i;
+			}
+			return -1;
+		}
+
+		void touch(int _slot)
+		{
+			unlink(_slot);
+			pushFront(_slot);
+		}
+
+		void unlink(int _slot)
+		{
+			Slot& slot = slots[_slot];
+			(slot.prev >= 0 ? slots[slot.prev].next : head) = slot.next;
+			(slot.next >= 0 ? slots[slot.next].prev : tail) = slot.prev;
+			slot.prev = slot.next = -1;
+		}
+
+		void pushFront(int _slot)
+		{
+			slots[_slot].next = head;
+			(head >= 0 ? slots[head].prev : tail) = _slot;
+			head = _slot;
+		}
+
+		void pushBack(int _slot)
+		{
+			slots[_slot].prev = tail;
+			(tail >= 0 ? slots[tail].next : head) = _slot;
+			tail = _slot;
+		}
+
+		std::vector<Slot> slots;
+		int head = -1;	// most recently used
+		int tail = -1;	// least recently used
+		Stats counters;
+
+		mutable std::mutex mutex;
+		std::condition_variable available;
+	};
+
+	// proxy keeping only the name and the position of a file, the real handle is borrowed from a FileHandlePool
+	// for the duration of each access. PooledFile, LazyFile and File can be used interchangeably.
+	// readAt/writeAt may be called from many threads: the slot a proxy last owned is looked up and (re)opened under
+	// the proxy's own lock, so a borrower never sees a handle another one is still opening. the i/o itself runs
+	// outside of it on the pinned slot
+	class PooledFile : public IFile
+	{
+	public:
+		explicit PooledFile(FileHandlePool& _pool) : pool(_pool) {}
+		~PooledFile() override { close(); }
+
+		PooledFile(const PooledFile&) = delete;
+		PooledFile& operator=(const PooledFile&) = delete;
+
+		bool open(const char* _name) override
+		{
+			close();
+			std::lock_guard<std::mutex> lock(stateMutex);
+			name = _name;
+			m_position = 0;
+			m_size = 0;
+			m_sizeKnown = false;
+			return !name.empty();
+		}
+
+		void close() override
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			if (m_slot >= 0)
+				pool.discard(this, m_slot, m_generation);
+			m_slot = -1;
+		}
+
+		size_t read(char* buffer, size_t size) override
+		{
+			int slot = borrow(true);
+			if (slot < 0)
+				return 0;
+
+			size_t bytesRead = pool.slots[slot].file.read(buffer, size);
+			m_position += bytesRead;
+			pool.release(slot, m_position);
+			return bytesRead;
+		}
+
+		void write(char* buffer, size_t size) override
+		{
+			int slot = borrow(false);
+			if (slot < 0)
+				return;
+
+			// positional, File::write doesn't say how much it wrote and asking the handle is another syscall
+			size_t bytesWritten = pool.slots[slot].file.writeAt(m_position, buffer, size);
+			pool.release(slot);
+			m_position += bytesWritten;
+			grow(m_position);
+		}
+
+		// positional access leaves the logical cursor alone, the handle is sought back to it on the next read or write
+		size_t readAt(size_t offset, char* buffer, size_t size) override
+		{
+			int slot = borrow(false);
+			if (slot < 0)
+				return 0;
+
+			size_t bytesRead = pool.slots[slot].file.readAt(offset, buffer, size);
+			pool.release(slot);
+			return bytesRead;
+		}
+
+		size_t writeAt(size_t offset, const char* buffer, size_t size) override
+		{
+			int slot = borrow(false);
+			if (slot < 0)
+				return 0;
+
+			size_t bytesWritten = pool.slots[slot].file.writeAt(offset, buffer, size);
+			pool.release(slot);
+			grow(offset + bytesWritten);
+			return bytesWritten;
+		}
+
+		bool sync() override
+		{
+			int slot = borrow(false);
+			if (slot < 0)
+				return false;
+
+			bool synced = pool.slots[slot].file.sync();
+			pool.release(slot);
+			return synced;
+		}
+
+		// only moves the logical cursor, the real handle follows on the next access
+		void seek(size_t offset) override { m_position = offset; }
+		size_t position() override { return m_position; }
+
+		size_t size() const override
+		{
+			if (!m_sizeKnown.load(std::memory_order_acquire))
+			{
+				int slot = const_cast<PooledFile*>(this)->borrow(false);
+				if (slot >= 0)
+					pool.release(slot);
+			}
+			return m_size.load(std::memory_order_relaxed);
+		}
+
+		bool isOpen() const override
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			return !name.empty();
+		}
+
+	private:
+		// pins the slot holding our handle, (re)opening it first when it was evicted. _cursor moves the handle
+		// to the logical position, for read and write. returns -1 when the file can't be opened
+		int borrow(bool _cursor)
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			if (name.empty())
+				return -1;
+
+			bool reopen = false;
+			m_slot = pool.acquire(this, m_slot, m_generation, m_everOpened, reopen, m_generation);
+			FileHandlePool::Slot& slot = pool.slots[m_slot];
+
+			// the slot is pinned, the pool lock isn't needed to touch its handle. other borrowers of this
+			// proxy wait for the lock above, those of other proxies can't get a pinned slot
+			if (reopen)
+			{
+				if (slot.file.isOpen())
+					slot.file.close();
+				if (!slot.file.open(name.c_str()))
+				{
+					pool.discard(this, m_slot, m_generation);
+					m_slot = -1;
+					return -1;
+				}
+
+				m_everOpened = true;
+				if (!m_sizeKnown.load(std::memory_order_relaxed))
+				{
+					m_size.store(slot.file.size(), std::memory_order_relaxed);
+					m_sizeKnown.store(true, std::memory_order_release);
+				}
+				slot.cursor = 0;
+			}
+
+			if (_cursor && slot.cursor.load(std::memory_order_relaxed) != m_position)
+				slot.file.seek(m_position);
+			return m_slot;
+		}
+
+		// concurrent writeAt calls race to extend the size, keep the largest
+		void grow(size_t _end)
+		{
+			size_t current = m_size.load(std::memory_order_relaxed);
+			while (_end > current && !m_size.compare_exchange_weak(current, _end, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		FileHandlePool& pool;
+		std::string name;
+		size_t m_position = 0;		// the logical cursor, read/write/seek aren't for many threads
+		std::atomic<size_t> m_size { 0 };
+		std::atomic<bool> m_sizeKnown { false };
+
+		// guarded by stateMutex
+		bool m_everOpened = false;
+		int m_slot = -1;			// last slot we owned, only valid while its generation matches
+		uint32_t m_generation = 0;
+		mutable std::mutex stateMutex;
+	};
+}
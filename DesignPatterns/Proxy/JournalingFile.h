@@ -0,0 +1,317 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include "ProxyPattern.h"
+
+namespace proxy_pattern
+{
+	struct GroupCommitConfig
+	{
+		size_t maxGroupBytes = 1024 * 1024;							// a group this large is committed right away
+		size_t maxGroupRecords = 1024;
+		std::chrono::microseconds maxLatency { 200 };				// how long an open group waits for more writers
+	};
+
+	// proxy making every write durable while paying for one sync per group of writes instead of one per write.
+	// writers append their record to the open group and block; a committer thread writes the whole group,
+	// syncs the file once and wakes everybody in it. reads go straight to the file and see committed data.
+	// write() appends at the end of the file like a journal, writeAt() commits at the given offset.
+	// open() only opens existing files, a new journal is a File opened with OpenMode::Create before it is wrapped
+	class JournalingFile : public IFile
+	{
+	public:
+		struct Stats
+		{
+			uint64_t records = 0;
+			uint64_t groups = 0;
+			uint64_t bytes = 0;
+
+			double recordsPerGroup() const { return groups ? double(records) / double(groups) : 0.0; }
+		};
+
+		JournalingFile(IFile* _file, const GroupCommitConfig& _config = GroupCommitConfig())
+			: m_file(_file)
+			, config(_config)
+		{
+			openGroup.outcome = std::make_shared<Outcome>();
+			committing.outcome = std::make_shared<Outcome>();
+			committing.outcome->committed = true;
+			m_end = m_file->size();
+			committer = std::thread([this] { commitLoop(); });
+		}
+
+		~JournalingFile() override
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			groupReady.notify_one();
+			committer.join();
+		}
+
+		JournalingFile(const JournalingFile&) = delete;
+		JournalingFile& operator=(const JournalingFile&) = delete;
+
+		bool open(const char* name) override
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			drain(lock);
+			bool opened = m_file->open(name);
+			m_end = m_file->size();
+			return opened;
+		}
+
+		void close() override
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			drain(lock);
+			m_file->close();
+		}
+
+		size_t read(char* buffer, size_t size) override { return m_file->read(buffer, size); }
+		size_t readAt(size_t offset, char* buffer, size_t size) override { return m_file->readAt(offset, buffer, size); }
+		void seek(size_t offset) override { m_file->seek(offset); }
+		size_t position() override { return m_file->position(); }
+		size_t size() const override
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return m_end;
+		}
+		bool isOpen() const override { return m_file->isOpen(); }
+
+		void write(char* buffer, size_t size) override
+		{
+			append(SIZE_MAX, buffer, size);
+		}
+
+		size_t writeAt(size_t offset, const char* buffer, size_t size) override
+		{
+			return append(offset, buffer, size) ? size : 0;
+		}
+
+		// waits for everything written so far, no extra sync when it is already durable
+		bool sync() override
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			return drain(lock);
+		}
+
+		Stats stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return counters;
+		}
+
+	private:
+		struct Record
+		{
+			size_t offset;
+			size_t size;
+			size_t data;	// offset into Group::bytes
+		};
+
+		// how a group's commit went, shared by the writers in it so each checks its own group however many
+		// groups are committed before it wakes up
+		struct Outcome
+		{
+			bool committed = false;
+			bool failed = false;
+		};
+
+		struct Group
+		{
+			std::vector<Record> records;
+			std::vector<char> bytes;
+			std::shared_ptr<Outcome> outcome;	// kept by clear(), the outcome of the last group stays readable
+
+			void clear()
+			{
+				records.clear();
+				bytes.clear();
+			}
+
+			void swap(Group& other)
+			{
+				records.swap(other.records);
+				bytes.swap(other.bytes);
+				outcome.swap(other.outcome);
+			}
+		};
+
+		// returns once the group the record went into is durable
+		bool append(size_t offset, const char* buffer, size_t size)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			// a full group is on its way to the disk, wait for the next one to open
+			groupSpace.wait(lock, [this, size] { return !isFull(size); });
+
+			if (offset == SIZE_MAX)
+				offset = m_end;
+			m_end = std::max(m_end, offset + size);
+
+			Group& group = openGroup;
+			if (group.records.empty())
+				groupOpened = std::chrono::steady_clock::now();
+			group.records.push_back(Record { offset, size, group.bytes.size() });
+			group.bytes.insert(group.bytes.end(), buffer, buffer + size);
+
+			std::shared_ptr<Outcome> outcome = group.outcome;
+			groupReady.notify_one();
+			groupCommitted.wait(lock, [&outcome] { return outcome->committed; });
+			return !outcome->failed;
+		}
+
+		bool isFull(size_t incoming) const
+		{
+			// a single oversized record still gets a group of its own
+			return !openGroup.records.empty()
+				&& (openGroup.records.size() >= config.maxGroupRecords || openGroup.bytes.size() + incoming > config.maxGroupBytes);
+		}
+
+		void commitLoop()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;)
+			{
+				groupReady.wait(lock, [this] { return stopping || !openGroup.records.empty(); });
+				if (openGroup.records.empty())
+					return;
+
+				// give more writers the chance to join, unless the group is already big enough
+				auto deadline = groupOpened + config.maxLatency;
+				groupReady.wait_until(lock, deadline, [this]
+				{
+					return stopping || openGroup.records.size() >= config.maxGroupRecords || openGroup.bytes.size() >= config.maxGroupBytes;
+				});
+
+				committing.swap(openGroup);
+				openGroup.outcome = std::make_shared<Outcome>();
+				groupSpace.notify_all();
+				lock.unlock();
+
+				bool ok = commit(committing);
+
+				lock.lock();
+				counters.records += committing.records.size();
+				counters.bytes += committing.bytes.size();
+				++counters.groups;
+				committing.clear();
+
+				committing.outcome->failed = !ok;
+				committing.outcome->committed = true;
+				groupCommitted.notify_all();
+			}
+		}
+
+		// contiguous records are merged into a single write
+		bool commit(const Group& group)
+		{
+			bool ok = true;
+			size_t i = 0;
+			while (i < group.records.size())
+			{
+				const Record& first = group.records[i];
+				size_t size = first.size;
+				size_t j = i + 1;
+				for (; j < group.records.size(); ++j)
+				{
+					const Record& next = group.records[j];
+					if (next.offset != first.offset + size || next.data != first.data + size)
+						break;
+					size += next.size;
+				}
+
+				ok &= m_file->writeAt(first.offset, group.bytes.data() + first.data, size) == size;
+				i = j;
+			}
+			return m_file->sync() && ok;
+		}
+
+		// returns false when the last group failed to commit
+		bool drain(std::unique_lock<std::mutex>& lock)
+		{
+			// the group being committed right now, if any, or the last one committed, is the one before the open group
+			std::shared_ptr<Outcome> outcome = openGroup.records.empty() ? committing.outcome : openGroup.outcome;
+			groupReady.notify_one();
+			groupCommitted.wait(lock, [&outcome] { return outcome->committed; });
+			return !outcome->failed;
+		}
+
+		IFile* m_file;
+		GroupCommitConfig config;
+		size_t m_end = 0;
+
+		Group openGroup;				// writers append here
+		Group committing;				// owned by the committer while it is unlocked
+		std::chrono::steady_clock::time_point groupOpened;
+		Stats counters;
+
+		bool stopping = false;
+		mutable std::mutex mutex;
+		std::condition_variable groupReady;
+		std::condition_variable groupSpace;
+		std::condition_variable groupCommitted;
+		std::thread committer;
+	};
+
+	// threadCount writers doing small durable writes, one sync per write vs group commit
+	inline void benchmarkGroupCommit(const char* path, unsigned threadCount, size_t recordsPerThread, size_t recordSize)
+	{
+		auto run = [&](bool grouped)
+		{
+			File file;
+			if (!file.open(path, OpenMode::Truncate))
+			{
+				std::cout << "benchmarkGroupCommit: can't open " << path << std::endl;
+				return;
+			}
+
+			JournalingFile journal(&file);
+			std::mutex fileMutex;
+			std::vector<std::thread> threads;
+
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned t = 0; t < threadCount; ++t)
+			{
+				threads.emplace_back([&, t]
+				{
+					std::vector<char> record(recordSize, char('a' + t % 26));
+					for (size_t i = 0; i < recordsPerThread; ++i)
+					{
+						if (grouped)
+						{
+							journal.write(record.data(), record.size());
+						}
+						else
+						{
+							std::lock_guard<std::mutex> lock(fileMutex);
+							file.writeAt(file.size(), record.data(), record.size());
+							file.sync();
+						}
+					}
+				});
+			}
+			for (auto& thread : threads)
+				thread.join();
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << (grouped ? "group commit  " : "sync per write") << ": "
+					  << double(threadCount * recordsPerThread) / seconds << " durable writes/s";
+			if (grouped)
+				std::cout << ", " << journal.stats().recordsPerGroup() << " records per group";
+			std::cout << std::endl;
+		};
+
+		run(false);
+		run(true);
+	}
+}
@@ -1,6 +1,27 @@
 #pragma once
 #include <string>
-#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 namespace proxy_pattern
 {
@@ -12,6 +33,15 @@ namespace proxy_pattern
 		virtual size_t read(char* buffer, size_t size) = 0;
 		virtual void write(char* buffer, size_t size) = 0;
 		virtual void seek(size_t offset) = 0;
+
+		// positional access, doesn't use the cursor of read/write/seek. on posix it doesn't move it either, on windows
+		// it leaves it after the bytes transferred: seek before going back to read/write.
+		// safe to call from many threads on the same file
+		virtual size_t readAt(size_t offset, char* buffer, size_t size) = 0;
+		virtual size_t writeAt(size_t offset, const char* buffer, size_t size) = 0;
+
+		// makes everything written so far durable
+		virtual bool sync() = 0;
 		
 		virtual size_t position() = 0;
 		virtual size_t size() const = 0;
@@ -20,54 +50,206 @@ namespace proxy_pattern
 		virtual ~IFile() {};
 	};
 
+	// thin layer over the platform file descriptor api
+	namespace native
+	{
+#if defined(_WIN32)
+		inline int open(const char* name, bool writable) { return _open(name, (writable ? _O_RDWR : _O_RDONLY) | _O_BINARY); }
+		inline int create(const char* name, bool truncate)
+		{
+			return _open(name, _O_RDWR | _O_CREAT | (truncate ? _O_TRUNC : 0) | _O_BINARY, _S_IREAD | _S_IWRITE);
+		}
+		inline void close(int fd) { _close(fd); }
+		inline int64_t read(int fd, char* buffer, size_t size) { return _read(fd, buffer, static_cast<unsigned>(size)); }
+		inline int64_t write(int fd, const char* buffer, size_t size) { return _write(fd, buffer, static_cast<unsigned>(size)); }
+		inline int64_t seek(int fd, int64_t offset, int whence) { return _lseeki64(fd, offset, whence); }
+		inline int64_t size(int fd)
+		{
+			struct _stat64 info;
+			return _fstat64(fd, &info) == 0 ? info.st_size : 0;
+		}
+
+		// windows has no pread/pwrite, an OVERLAPPED offset reads or writes at that offset. on a handle not opened
+		// with FILE_FLAG_OVERLAPPED, which the crt descriptors aren't, the file pointer still ends up after the transfer
+		inline int64_t readAt(int fd, int64_t offset, char* buffer, size_t size)
+		{
+			OVERLAPPED overlapped{};
+			overlapped.Offset = static_cast<DWORD>(offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD bytes = 0;
+			if (!ReadFile(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), buffer, static_cast<DWORD>(size), &bytes, &overlapped))
+				return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+			return bytes;
+		}
+		inline int64_t writeAt(int fd, int64_t offset, const char* buffer, size_t size)
+		{
+			OVERLAPPED overlapped{};
+			overlapped.Offset = static_cast<DWORD>(offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD bytes = 0;
+			if (!WriteFile(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), buffer, static_cast<DWORD>(size), &bytes, &overlapped))
+				return -1;
+			return bytes;
+		}
+		inline bool sync(int fd) { return _commit(fd) == 0; }
+#else
+		inline int open(const char* name, bool writable) { return ::open(name, writable ? O_RDWR : O_RDONLY); }
+		inline int create(const char* name, bool truncate) { return ::open(name, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644); }
+		inline void close(int fd) { ::close(fd); }
+		inline int64_t read(int fd, char* buffer, size_t size) { return ::read(fd, buffer, size); }
+		inline int64_t write(int fd, const char* buffer, size_t size) { return ::write(fd, buffer, size); }
+		inline int64_t seek(int fd, int64_t offset, int whence) { return ::lseek(fd, offset, whence); }
+		inline int64_t size(int fd)
+		{
+			struct stat info;
+			return ::fstat(fd, &info) == 0 ? info.st_size : 0;
+		}
+		inline int64_t readAt(int fd, int64_t offset, char* buffer, size_t size) { return ::pread(fd, buffer, size, offset); }
+		inline int64_t writeAt(int fd, int64_t offset, const char* buffer, size_t size) { return ::pwrite(fd, buffer, size, offset); }
+#if defined(__APPLE__)
+		inline bool sync(int fd) { return ::fsync(fd) == 0; }
+#else
+		// data only, metadata like mtime isn't needed to read the data back
+		inline bool sync(int fd) { return ::fdatasync(fd) == 0; }
+#endif
+#endif
+	}
+
+	// how File::open treats a file that isn't there yet or has data in it
+	enum class OpenMode
+	{
+		Existing,	// fails on a missing file, read-write or else read-only
+		Create,		// read-write, created when missing
+		Truncate	// read-write, created when missing and emptied otherwise
+	};
+
 	class File: public IFile
 	{
 	public:
-		bool open(const char* name) override;
+		File() = default;
+		~File() override { close(); }
+
+		File(const File&) = delete;
+		File& operator=(const File&) = delete;
+
+		bool open(const char* name) override { return open(name, OpenMode::Existing); }
+		bool open(const char* name, OpenMode mode);
 		void close() override;
 		size_t read(char* buffer, size_t size) override;
 		void write(char* buffer, size_t size) override;
 		void seek(size_t offset) override;
+		size_t readAt(size_t offset, char* buffer, size_t size) override;
+		size_t writeAt(size_t offset, const char* buffer, size_t size) override;
+		bool sync() override;
 		size_t position() override;
 		size_t size() const override;
 		bool isOpen() const override;
+
+		// the platform descriptor, for proxies that drive the file through their own i/o machinery
+		int nativeHandle() const { return fd; }
 	
 	private:
-		size_t m_size;
-		std::fstream file;
+		void grow(size_t end);
+
+		std::atomic<size_t> m_size { 0 };
+		int fd = -1;
 	};
 
-	bool File::open(const char* name)
+	bool File::open(const char* name, OpenMode mode)
 	{
-		file.open(name, std::ifstream::ate | std::ifstream::binary);
-		m_size = file.tellg();
-		file.seekg(std::ifstream::beg);
-		return file.is_open();
+		close();
+
+		if (mode != OpenMode::Existing)
+		{
+			fd = native::create(name, mode == OpenMode::Truncate);
+		}
+		else
+		{
+			fd = native::open(name, true);
+			if (fd < 0) // read-only fallback
+				fd = native::open(name, false);
+		}
+		if (fd < 0)
+			return false;
+
+		m_size = static_cast<size_t>(native::size(fd));
+		return true;
 	}
 
 	void File::close()
 	{
-		file.close();
+		if (fd >= 0)
+			native::close(fd);
+		fd = -1;
 	}
 
 	size_t File::read(char* buffer, size_t size)
 	{
-		file.read(buffer, size);
+		size_t total = 0;
+		while (fd >= 0 && total < size)
+		{
+			int64_t bytes = native::read(fd, buffer + total, size - total);
+			if (bytes <= 0)
+				break;
+			total += static_cast<size_t>(bytes);
+		}
+		return total;
 	}
 
 	void File::write(char* buffer, size_t size)
 	{
-		file.write(buffer, size);
+		size_t total = 0;
+		while (fd >= 0 && total < size)
+		{
+			int64_t bytes = native::write(fd, buffer + total, size - total);
+			if (bytes <= 0)
+				break;
+			total += static_cast<size_t>(bytes);
+		}
+		grow(position());
 	}
 
 	void File::seek(size_t offset)
 	{
-		file.seekg(offset);
+		if (fd >= 0)
+			native::seek(fd, static_cast<int64_t>(offset), SEEK_SET);
+	}
+
+	size_t File::readAt(size_t offset, char* buffer, size_t size)
+	{
+		size_t total = 0;
+		while (fd >= 0 && total < size)
+		{
+			int64_t bytes = native::readAt(fd, static_cast<int64_t>(offset + total), buffer + total, size - total);
+			if (bytes <= 0)
+				break;
+			total += static_cast<size_t>(bytes);
+		}
+		return total;
+	}
+
+	size_t File::writeAt(size_t offset, const char* buffer, size_t size)
+	{
+		size_t total = 0;
+		while (fd >= 0 && total < size)
+		{
+			int64_t bytes = native::writeAt(fd, static_cast<int64_t>(offset + total), buffer + total, size - total);
+			if (bytes <= 0)
+				break;
+			total += static_cast<size_t>(bytes);
+		}
+		grow(offset + total);
+		return total;
+	}
+
+	bool File::sync()
+	{
+		return fd >= 0 && native::sync(fd);
 	}
 
 	size_t File::position()
 	{
-		return file.tellg();
+		return fd >= 0 ? static_cast<size_t>(native::seek(fd, 0, SEEK_CUR)) : 0;
 	}
 
 	size_t File::size() const
@@ -77,13 +259,23 @@ namespace proxy_pattern
 
 	bool File::isOpen() const
 	{
-		return file.is_open();
+		return fd >= 0;
+	}
+
+	void File::grow(size_t end)
+	{
+		// concurrent writeAt calls race to extend the size, keep the largest
+		size_t current = m_size.load(std::memory_order_relaxed);
+		while (end > current && !m_size.compare_exchange_weak(current, end, std::memory_order_relaxed))
+		{
+		}
 	}
 
 	// proxy the access to the object, inherits the same interface as the original object.
 	// LazyFile and File can be used interchangeably
 	class LazyFile: public IFile
 	{
+	public:
 		bool open(const char* _name) override
 		{
 			name = _name;
@@ -91,8 +283,10 @@ namespace proxy_pattern
 		}
 		void close() override
 		{
+			std::lock_guard<std::mutex> lock(openMutex);
 			if (file.isOpen())
 				file.close();
+			opened.store(false, std::memory_order_release);
 		}
 		size_t read(char* buffer, size_t size) override
 		{
@@ -109,6 +303,20 @@ namespace proxy_pattern
 			openIfRequired();
 			file.seek(offset);
 		}
+		size_t readAt(size_t offset, char* buffer, size_t size) override
+		{
+			openIfRequired();
+			return file.readAt(offset, buffer, size);
+		}
+		size_t writeAt(size_t offset, const char* buffer, size_t size) override
+		{
+			openIfRequired();
+			return file.writeAt(offset, buffer, size);
+		}
+		bool sync() override
+		{
+			return isOpen() && file.sync();
+		}
 		size_t position() override
 		{
 			return file.position();
@@ -117,20 +325,82 @@ namespace proxy_pattern
 		{
 			return file.size();
 		}
-		bool isOpen() const 
+		bool isOpen() const override
 		{ 
-			file.isOpen(); 
+			return opened.load(std::memory_order_acquire);
 		}
 
 	private:
+		// many threads may hit a LazyFile for the first time at once, only one of them opens it
 		void openIfRequired()
 		{
-			if (!isOpen())
-				file.open(name.c_str());
+			if (opened.load(std::memory_order_acquire))
+				return;
+
+			std::lock_guard<std::mutex> lock(openMutex);
+			if (!opened.load(std::memory_order_relaxed))
+				opened.store(file.open(name.c_str()), std::memory_order_release);
 		}
 
 		std::string name;
 		File file;
+		std::atomic<bool> opened { false };
+		std::mutex openMutex;
 	};
 
-}
\ No newline at end of file
+	// N threads reading random blocks of the same file, once through a shared cursor guarded by a lock (seek + read)
+	// and once through readAt which needs no shared mutable state
+	inline void benchmarkRandomReads(IFile& file, unsigned threadCount, size_t readsPerThread, size_t blockSize)
+	{
+		size_t blocks = file.size() / blockSize;
+		if (blocks == 0)
+		{
+			std::cout << "benchmarkRandomReads: file smaller than one block" << std::endl;
+			return;
+		}
+
+		auto run = [&](bool positional)
+		{
+			std::mutex cursorMutex;
+			std::atomic<size_t> bytes { 0 };
+			std::vector<std::thread> threads;
+
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned t = 0; t < threadCount; ++t)
+			{
+				threads.emplace_back([&, t]
+				{
+					std::mt19937_64 rng(t + 1);
+					std::vector<char> buffer(blockSize);
+					size_t local = 0;
+
+					for (size_t i = 0; i < readsPerThread; ++i)
+					{
+						size_t offset = (rng() % blocks) * blockSize;
+						if (positional)
+						{
+							local += file.readAt(offset, buffer.data(), blockSize);
+						}
+						else
+						{
+							std::lock_guard<std::mutex> lock(cursorMutex);
+							file.seek(offset);
+							local += file.read(buffer.data(), blockSize);
+						}
+					}
+					bytes += local;
+				});
+			}
+			for (auto& thread : threads)
+				thread.join();
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << (positional ? "readAt      " : "seek + read ") << threadCount << " threads: "
+					  << double(threadCount * readsPerThread) / seconds << " reads/s, "
+					  << double(bytes) / seconds / (1024.0 * 1024.0) << " MiB/s" << std::endl;
+		};
+
+		run(false);
+		run(true);
+	}
+}